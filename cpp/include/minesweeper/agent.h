@@ -1,51 +1,138 @@
 #pragma once
 
+#include <array>
+#include <memory>
 #include <optional>
 #include "mines.h"
 #include "simulation.h"
+#include "threadpool.h"
 #include "tree.h"
 
 namespace agent {
-    std::vector<game::Action> getExactActionsWeak(const game::State &state);
+    // both solvers work on one component at a time, a split matrix or decoupled constraints give them all of
+    // them, the state overloads build the matrix first
+    std::vector<game::Action> getExactActionsWeak(const game::ConstraintView &component);
 
-    std::vector<game::Action> getExactActionsStrong(const game::State &state);
+    std::vector<game::Action> getExactActionsWeak(const game::ConstraintMatrix &components);
 
+    std::vector<game::Action> getExactActionsWeak(const std::vector<game::Constraint> &components);
+
+    std::vector<game::Action> getExactActionsStrong(const game::ConstraintView &component);
+
+    std::vector<game::Action> getExactActionsStrong(const game::ConstraintMatrix &components);
+
+    std::vector<game::Action> getExactActionsStrong(const std::vector<game::Constraint> &components);
+
+    // local rules on a single component, cheap enough to run before any of the solvers above
+    std::vector<game::Action> getSaturatedActions(const game::ConstraintView &component);
+
+    std::vector<game::Action> getSubsetActions(const game::ConstraintView &component);
+
+    template<class G>
+    std::vector<game::Action> getExactActionsWeak(const game::State<G> &state);
+
+    template<class G>
+    std::vector<game::Action> getExactActionsStrong(const game::State<G> &state);
+
+    // solver tiers in order of cost, a component only reaches a tier if every cheaper one settled nothing
+    enum class SolverTier {
+        Saturation,     // a group with no mines left or as many mines as cells
+        Subset,         // a group inside another one leaves the difference saturated
+        Elimination,    // getExactActionsWeak
+        Enumeration     // getExactActionsStrong
+    };
+
+    struct SolverStats {
+        static const int TIERS = 4;
+
+        std::array<long long, TIERS> components{};  // components the tier was run on
+        std::array<long long, TIERS> settled{};     // components it found actions for
+        std::array<long long, TIERS> actions{};
+        std::array<double, TIERS> seconds{};
+    };
+
+    // Runs the solver tiers component by component and escalates only the ones left unsettled.
+    // Finds an action exactly when getExactActionsStrong does, most of the time without enumerating.
+    class SolverPipeline {
+    public:
+        std::vector<game::Action> getActions(const game::ConstraintMatrix &components);
+
+        std::vector<game::Action> getActions(const std::vector<game::Constraint> &components);
+
+        template<class G>
+        std::vector<game::Action> getActions(const game::State<G> &state);
+
+        // tier that settled each action of the last call, in the same order
+        const std::vector<SolverTier> &getTiers() const {
+            return tiers_;
+        }
+
+        const SolverStats &getStats() const {
+            return stats_;
+        }
+
+        void resetStats() {
+            stats_ = SolverStats();
+        }
+
+    private:
+        // actions of the cheapest tier that settles anything in the component
+        std::vector<game::Action> settleComponent(const game::ConstraintView &component);
+
+        std::vector<game::Action> runTier(SolverTier tier, const game::ConstraintView &component);
+
+    private:
+        std::vector<SolverTier> tiers_;
+        SolverStats stats_;
+    };
+
+    template<class G>
     class RandomAgent {
     public:
         explicit RandomAgent(std::mt19937 &gen) : gen_(gen) {}
 
-        std::vector<game::Action> getActions(const game::State &state);
+        std::vector<game::Action> getActions(const game::State<G> &state);
 
-        game::GameResult rollout(game::PerfectBoard board);
+        game::GameResult rollout(game::PerfectBoard<G> board);
 
     private:
+        // a uniformly drawn legal action, there has to be one
+        game::Action getRandomAction(const game::State<G> &state);
+
         std::mt19937 &gen_;
+        std::array<game::ActionId, G::HEIGHT * G::WIDTH> actions_;
     };
 
+    template<class G>
     class TreeAgent {
     public:
-        explicit TreeAgent(std::mt19937 &gen) : tree_(gen), gen_(gen) {}
+        // more than one tree makes a root-parallel ensemble, explorations go to the trees in turn
+        explicit TreeAgent(std::mt19937 &gen, int trees = 1) : trees_(gen, trees), gen_(gen) {}
 
-        TreeAgent(const TreeAgent &agent) : tree_(agent.tree_), gen_(agent.gen_) {}
+        TreeAgent(const TreeAgent &agent) : trees_(agent.trees_), solver_(agent.solver_), gen_(agent.gen_),
+                                            iter_(agent.iter_) {}
 
         TreeAgent &operator=(const TreeAgent &agent) {
             *this = TreeAgent(agent);
             return *this;
         }
 
-        TreeAgent(TreeAgent &&agent) : tree_(std::move(agent.tree_)), gen_(agent.gen_) {}
+        TreeAgent(TreeAgent &&agent) : trees_(std::move(agent.trees_)), solver_(agent.solver_), gen_(agent.gen_),
+                                       iter_(agent.iter_) {}
 
         TreeAgent &operator=(TreeAgent &&agent) {
-            tree_ = std::move(agent.tree_);
+            trees_ = std::move(agent.trees_);
+            solver_ = agent.solver_;
             gen_ = agent.gen_;
+            iter_ = agent.iter_;
             return *this;
         }
 
-        void loadState(game::State state, std::vector<double> policy);
+        void loadState(game::State<G> state, std::vector<double> policy);
 
-        std::vector<game::Action> getActions(const game::State &state);
+        std::vector<game::Action> getActions(const game::State<G> &state);
 
-        std::optional<game::State> explore();
+        std::optional<game::State<G>> explore();
 
         void update(std::vector<double> policy, double value);
 
@@ -53,30 +140,69 @@ namespace agent {
             return iter_;
         }
 
-        const game::State &getState() const {
-            return tree_.getRoot()->state;
+        const game::State<G> &getState() const {
+            return trees_[0].getRootState();
+        }
+
+        // root of the last search with its visits summed over the trees
+        std::vector<game::Action> getRootActions() const {
+            return trees_[0].getRootActions();
+        }
+
+        std::vector<int> getRootVisits() const {
+            return trees_.getRootVisits();
+        }
+
+        const SolverPipeline &getSolver() const {
+            return solver_;
+        }
+
+    private:
+        tree::Tree<G> &getCurrentTree() {
+            return trees_[iter_.value() % trees_.size()];
         }
 
     private:
-        tree::Tree tree_;
+        tree::Ensemble<G> trees_;
+        SolverPipeline solver_;
         std::mt19937 &gen_;
         std::optional<int> iter_;
     };
 
+    template<class G>
     class SimpleTreeAgent {
     private:
         const int STEPS = 50;
 
     public:
-        explicit SimpleTreeAgent(std::mt19937 &gen) : tree_(gen), gen_(gen) {}
+        // more than one thread searches a shared tree in parallel, more than one tree makes a root-parallel
+        // ensemble searched with a thread per tree, kept in a pool for the whole game
+        explicit SimpleTreeAgent(std::mt19937 &gen, int threads = 1, int trees = 1)
+                : trees_(gen, trees), gen_(gen), threads_(threads),
+                  pool_(trees > 1 ? std::make_unique<ThreadPool>(trees) : nullptr) {}
 
-        std::vector<game::Action> getActions(const game::State &state);
+        std::vector<game::Action> getActions(const game::State<G> &state);
+
+        const SolverPipeline &getSolver() const {
+            return solver_;
+        }
+
+        // statistics of the last parallel or ensemble search
+        const typename tree::Tree<G>::SearchStats &getSearchStats() const {
+            return searchStats_;
+        }
 
     private:
-        static std::vector<double> getSimplePolicy(const game::State &state);
+        static std::vector<double> getSimplePolicy(const game::State<G> &state);
+
+        void searchEnsemble();
 
     private:
-        tree::Tree tree_;
+        tree::Ensemble<G> trees_;
+        SolverPipeline solver_;
         std::mt19937 &gen_;
+        int threads_;
+        std::unique_ptr<ThreadPool> pool_;
+        typename tree::Tree<G>::SearchStats searchStats_;
     };
 }
\ No newline at end of file
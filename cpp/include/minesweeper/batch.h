@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+#include "agent.h"
+#include "threadpool.h"
+
+namespace agent {
+    // component statistics of a state, in this order
+    enum class BatchStat {
+        Components,         // decoupled constraints
+        FrontierCells,      // unknown cells touching an opened one
+        LargestComponent,   // cells of the largest constraint
+        InteriorCells,      // unknown cells away from the frontier
+        Count
+    };
+
+    // Analyses count states, height x width bytes each, on the pool. The results go to caller provided
+    // arrays, count x height x width for the cells and count x BatchStat::Count for the statistics:
+    // actions - 1 for a cell getExactActionsStrong opens, -1 for one it flags, 0 otherwise
+    // probability - mine probability of every cell, as AnalysisMode::Counts finds it
+    // A state no mine layout agrees with gets no actions, NaN probabilities and statistics of -1. Throws
+    // std::invalid_argument before analysing anything when a cell holds a value no state has
+    template<class G>
+    void analyzeBatch(const uint8_t *states, int count, G geometry, ThreadPool &pool, int8_t *actions,
+                      float *probability, int32_t *stats);
+}
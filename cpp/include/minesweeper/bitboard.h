@@ -0,0 +1,219 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace game {
+    // One bit per cell, rows padded to a 32 bit stride so that moving a cell to any of its
+    // neighbors is a single multi-word shift by at most STRIDE + 1 bits.
+    template<int Rows>
+    class Bitboard {
+    public:
+        static const int STRIDE = 32;
+        static const int WORDS = (Rows * STRIDE + 63) / 64;
+
+        bool test(int i, int j) const {
+            int bit = i * STRIDE + j;
+            return (words_[bit >> 6] >> (bit & 63)) & 1;
+        }
+
+        void set(int i, int j) {
+            int bit = i * STRIDE + j;
+            words_[bit >> 6] |= uint64_t(1) << (bit & 63);
+        }
+
+        void reset(int i, int j) {
+            int bit = i * STRIDE + j;
+            words_[bit >> 6] &= ~(uint64_t(1) << (bit & 63));
+        }
+
+        void assign(int i, int j, bool value) {
+            int bit = i * STRIDE + j;
+            words_[bit >> 6] = (words_[bit >> 6] & ~(uint64_t(1) << (bit & 63))) |
+                               (uint64_t(value) << (bit & 63));
+        }
+
+        uint32_t row(int i) const {
+            return static_cast<uint32_t>(words_[i >> 1] >> ((i & 1) * STRIDE));
+        }
+
+        int count() const {
+            int count = 0;
+            for (uint64_t word: words_) {
+                count += __builtin_popcountll(word);
+            }
+            return count;
+        }
+
+        bool any() const {
+            uint64_t any = 0;
+            for (uint64_t word: words_) {
+                any |= word;
+            }
+            return any;
+        }
+
+        // number of set cells in the 3x3 window centered at (i, j)
+        int countAround(int i, int j) const {
+            int count = 0;
+            for (int n = i - 1; n <= i + 1; ++n) {
+                if (n >= 0 && n < Rows) {
+                    count += __builtin_popcountll((uint64_t(row(n)) << 1 >> j) & 7);
+                }
+            }
+            return count;
+        }
+
+        // moves every cell by (dRow, dColumn) with |dRow|, |dColumn| <= 1, cells leaving the board are dropped
+        Bitboard shift(int dRow, int dColumn) const {
+            Bitboard result;
+            int distance = dRow * STRIDE + dColumn;
+
+            if (distance > 0) {
+                for (int w = WORDS - 1; w >= 0; --w) {
+                    result.words_[w] = words_[w] << distance | (w ? words_[w - 1] >> (64 - distance) : 0);
+                }
+            } else if (distance < 0) {
+                distance = -distance;
+                for (int w = 0; w < WORDS; ++w) {
+                    result.words_[w] = words_[w] >> distance | (w + 1 < WORDS ? words_[w + 1] << (64 - distance) : 0);
+                }
+            } else {
+                result.words_ = words_;
+            }
+
+            uint64_t columnMask = ~uint64_t(0);
+            if (dColumn > 0) {
+                columnMask = ~FIRST_COLUMN;
+            } else if (dColumn < 0) {
+                columnMask = ~(FIRST_COLUMN << (STRIDE - 1));
+            }
+            for (uint64_t &word: result.words_) {
+                word &= columnMask;
+            }
+            result.words_[WORDS - 1] &= LAST_WORD;
+
+            return result;
+        }
+
+        template<class F>
+        void forEach(F f) const {
+            for (int w = 0; w < WORDS; ++w) {
+                uint64_t word = words_[w];
+                while (word) {
+                    int bit = w * 64 + __builtin_ctzll(word);
+                    f(bit / STRIDE, bit % STRIDE);
+                    word &= word - 1;
+                }
+            }
+        }
+
+        static Bitboard rectangle(int height, int width) {
+            Bitboard result;
+            uint64_t row = width >= STRIDE ? ~uint32_t(0) : (uint64_t(1) << width) - 1;
+            for (int i = 0; i < height; ++i) {
+                result.words_[i >> 1] |= row << ((i & 1) * STRIDE);
+            }
+            return result;
+        }
+
+        Bitboard &operator&=(const Bitboard &other) {
+            for (int w = 0; w < WORDS; ++w) {
+                words_[w] &= other.words_[w];
+            }
+            return *this;
+        }
+
+        Bitboard &operator|=(const Bitboard &other) {
+            for (int w = 0; w < WORDS; ++w) {
+                words_[w] |= other.words_[w];
+            }
+            return *this;
+        }
+
+        Bitboard &operator^=(const Bitboard &other) {
+            for (int w = 0; w < WORDS; ++w) {
+                words_[w] ^= other.words_[w];
+            }
+            return *this;
+        }
+
+        // clears every cell set in other
+        Bitboard &operator-=(const Bitboard &other) {
+            for (int w = 0; w < WORDS; ++w) {
+                words_[w] &= ~other.words_[w];
+            }
+            return *this;
+        }
+
+        friend Bitboard operator&(Bitboard lhs, const Bitboard &rhs) {
+            return lhs &= rhs;
+        }
+
+        friend Bitboard operator|(Bitboard lhs, const Bitboard &rhs) {
+            return lhs |= rhs;
+        }
+
+        friend Bitboard operator^(Bitboard lhs, const Bitboard &rhs) {
+            return lhs ^= rhs;
+        }
+
+        friend Bitboard operator-(Bitboard lhs, const Bitboard &rhs) {
+            return lhs -= rhs;
+        }
+
+        bool operator==(const Bitboard &other) const {
+            return words_ == other.words_;
+        }
+
+        bool operator!=(const Bitboard &other) const {
+            return words_ != other.words_;
+        }
+
+    private:
+        static const uint64_t FIRST_COLUMN = uint64_t(1) | uint64_t(1) << STRIDE;
+        static const uint64_t LAST_WORD = Rows * STRIDE % 64 ? (uint64_t(1) << (Rows * STRIDE % 64)) - 1 : ~uint64_t(0);
+
+        std::array<uint64_t, WORDS> words_{};
+    };
+
+    // the lowest eight bits as eight bytes of 0 or 1, lowest bit in the first byte on little endian targets
+    inline uint64_t spreadBits(uint32_t bits) {
+        static constexpr auto table = []() {
+            std::array<uint64_t, 256> table{};
+            for (int byte = 0; byte < 256; ++byte) {
+                for (int k = 0; k < 8; ++k) {
+                    table[byte] |= uint64_t(byte >> k & 1) << (8 * k);
+                }
+            }
+            return table;
+        }();
+        return table[bits & 0xff];
+    }
+
+    // every cell that is set or has a set neighbor
+    template<int Rows>
+    Bitboard<Rows> dilate(const Bitboard<Rows> &board) {
+        auto horizontal = board | board.shift(0, -1) | board.shift(0, 1);
+        return horizontal | horizontal.shift(-1, 0) | horizontal.shift(1, 0);
+    }
+
+    // bit-sliced neighbor count: bit k of the count of cell (i, j) is counts[k].test(i, j)
+    template<int Rows>
+    std::array<Bitboard<Rows>, 4> countNeighbors(const Bitboard<Rows> &board) {
+        std::array<Bitboard<Rows>, 4> counts;
+        for (int dRow = -1; dRow <= 1; ++dRow) {
+            for (int dColumn = -1; dColumn <= 1; ++dColumn) {
+                if (dRow || dColumn) {
+                    auto carry = board.shift(dRow, dColumn);
+                    for (auto &count: counts) {
+                        auto next = count & carry;
+                        count ^= carry;
+                        carry = next;
+                    }
+                }
+            }
+        }
+        return counts;
+    }
+}
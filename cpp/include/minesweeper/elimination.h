@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace agent {
+    // Gaussian elimination specialised for mine constraint systems. Coefficients start as 0 and 1 and
+    // are kept as int8 rows padded to a multiple of 64 columns, so row updates compile to wide vector
+    // operations. Next to them every row and every column keeps a bit per nonzero entry, pivots and
+    // the rows to update are found from those bits instead of scanning the matrix. The storage grows
+    // to the largest system seen and is reused afterwards.
+    class EliminationWorkspace {
+    public:
+        static const int ALIGNMENT = 64;
+
+        // prepares a zero system of the given size
+        void reset(int rows, int columns);
+
+        // to be called once per nonzero coefficient
+        void set(int row, int column, int8_t coefficient) {
+            coefficients_[row * stride_ + column] = coefficient;
+            rowMask_[row * columnWords_ + column / 64] |= uint64_t(1) << (column % 64);
+            columnMask_[column * rowWords_ + row / 64] |= uint64_t(1) << (row % 64);
+            begin_[row] = std::min(begin_[row], column);
+            end_[row] = std::max(end_[row], column + 1);
+        }
+
+        void setValue(int row, int value) {
+            values_[row] = value;
+        }
+
+        // eliminates column by column with pivots of 1 or -1, stops as soon as every row
+        // that has not been a pivot yet is empty
+        void eliminate();
+
+        // cells the reduced system forces together with whether they are mines
+        void getForced(std::vector<std::pair<int, bool>> &forced) const;
+
+        int rows() const {
+            return rows_;
+        }
+
+        int columns() const {
+            return columns_;
+        }
+
+        int8_t coefficient(int row, int column) const {
+            return coefficients_[row * stride_ + column];
+        }
+
+        int value(int row) const {
+            return values_[row];
+        }
+
+    private:
+        void subtractRow(int row, int pivot, int scale);
+
+    private:
+        // coefficients may grow under elimination, rows that would leave this range are not updated
+        static const int LIMIT = 64;
+
+        int rows_ = 0;
+        int columns_ = 0;
+        int stride_ = 0;
+        int rowWords_ = 0;
+        int columnWords_ = 0;
+
+        std::vector<int8_t> coefficients_;
+        std::vector<int> values_;
+        std::vector<int> magnitude_;  // bound on the absolute value of any coefficient of a row
+
+        std::vector<uint64_t> rowMask_;     // nonzero columns of every row
+        std::vector<uint64_t> columnMask_;  // nonzero rows of every column
+        std::vector<uint64_t> free_;        // rows that have not been a pivot
+        // columns outside [begin, end) of a row are zero
+        std::vector<int> begin_;
+        std::vector<int> end_;
+    };
+}
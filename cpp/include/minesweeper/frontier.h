@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+#include "mines.h"
+#include "state.h"
+
+namespace game {
+    // Decoupled mine constraints of a state that follow its changes cell by cell.
+    // A change only invalidates the components around the changed cell, those are rebuilt
+    // on the next query while every other component is kept as it is.
+    template<class G>
+    class Frontier {
+    public:
+        Frontier() {
+            component_.fill(-1);
+        }
+
+        // forgets everything and schedules the whole frontier of state to be built
+        void reset(const State<G> &state);
+
+        // to be called once cell (i, j) of state went from unknown to opened or flagged
+        void update(const State<G> &state, int i, int j);
+
+        // the same for all of cells at once
+        void update(const State<G> &state, const typename State<G>::Mask &cells);
+
+        const std::vector<Constraint> &getConstraints(const State<G> &state);
+
+        // components built since the previous call, solvers can skip the ones they have already seen
+        std::vector<Constraint> getChangedConstraints(const State<G> &state);
+
+    private:
+        using Mask = typename State<G>::Mask;
+
+        static int getIndex(int i, int j) {
+            return i * G::WIDTH + j;
+        }
+
+        void invalidate(int component);
+
+        void build(const State<G> &state);
+
+        void buildComponent(const State<G> &state, int i, int j);
+
+    private:
+        std::array<int, G::HEIGHT * G::WIDTH> component_;
+        std::array<int, G::HEIGHT * G::WIDTH> index_;
+
+        std::vector<Constraint> components_;
+        std::vector<bool> changed_;
+        Mask dirty_;
+    };
+}
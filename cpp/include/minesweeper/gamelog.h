@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "simulation.h"
+
+namespace agent {
+    // A played game as far as training needs it: the mine layout, the actions in order and the root visits
+    // of the searches actions were sampled from. The states follow from replaying the actions on the layout
+    template<class G>
+    struct GameLog {
+        G geometry;
+        typename game::State<G>::Mask mines;
+        std::vector<game::Action> actions;
+        std::vector<int> searches;  // visit entries of each action, 0 for actions of the solver
+        std::vector<std::pair<game::Action, int>> visits;
+        double result = 0;
+    };
+
+    template<class G>
+    class LoggingBoard {
+    public:
+        explicit LoggingBoard(std::mt19937 &gen, G geometry = G()) : board_(gen, geometry) {
+            log_.geometry = geometry;
+        }
+
+        LoggingBoard(const LoggingBoard &board) : board_(board.board_), log_(board.log_), search_(board.search_) {}
+
+        LoggingBoard &operator=(const LoggingBoard &board) {
+            *this = LoggingBoard(board);
+            return *this;
+        }
+
+        LoggingBoard(LoggingBoard &&board) : board_(std::move(board.board_)), log_(std::move(board.log_)),
+                                             search_(board.search_) {}
+
+        LoggingBoard &operator=(LoggingBoard &&board) {
+            board_ = std::move(board.board_);
+            log_ = std::move(board.log_);
+            search_ = board.search_;
+            return *this;
+        }
+
+        // root visits of the search the next action comes from, actions it never tried are left out
+        void logSearch(const std::vector<game::Action> &actions, const std::vector<int> &visits) {
+            for (int i = 0; i < actions.size(); ++i) {
+                if (visits[i] > 0) {
+                    log_.visits.emplace_back(actions[i], visits[i]);
+                    ++search_;
+                }
+            }
+        }
+
+        game::GameResult act(game::Action action) {
+            log_.actions.emplace_back(action);
+            log_.searches.push_back(search_);
+            search_ = 0;
+
+            auto result = board_.act(action);
+            if (isTerminal(result)) {
+                log_.result = getReward(result);
+            }
+
+            return result;
+        }
+
+        GameLog<G> getLogs() {
+            log_.mines = board_.getMines();
+            return std::move(log_);
+        }
+
+        const game::State<G> &getState() const {
+            return board_.getState();
+        }
+
+    private:
+        game::Board<G> board_;
+        GameLog<G> log_;
+        int search_ = 0;
+    };
+
+    // Games on disk are records one after another, every part of a record starts 4 byte aligned, integers
+    // are little endian:
+    //   header     GameHeader
+    //   mines      a bit per cell in row major order, lowest bit first
+    //   actions    uint16 per action, the action id minus the previous one modulo 2^16
+    //   searches   uint16 per action, visit entries of the action
+    //   visits     a pair of uint16 per entry, action id and visits saturated at 65535
+    // Action ids are game::packAction with the width of the played board
+    struct GameHeader {
+        static const uint32_t MAGIC = 0x314c474d;  // "MGL1"
+
+        uint32_t magic;
+        uint32_t size;  // bytes of the whole record
+        uint16_t height;
+        uint16_t width;
+        uint16_t mines;
+        uint16_t actions;
+        uint32_t visits;
+        float result;
+        uint32_t reserved[2];
+    };
+
+    // Appends games to shards prefix-00000.bin, prefix-00001.bin and so on, a shard holds gamesPerShard
+    // games. The writer starts after the shards already there, so runs never write into each other's files.
+    // The first shard is opened on construction, a prefix that cannot be written to throws right away
+    template<class G>
+    class GameWriter {
+    public:
+        explicit GameWriter(std::string prefix, int gamesPerShard = 1 << 12);
+
+        void write(const GameLog<G> &log);
+
+        int getGames() const {
+            return games_;
+        }
+
+        static std::string getShardName(const std::string &prefix, int shard);
+
+    private:
+        void openShard();
+
+    private:
+        std::string prefix_;
+        int gamesPerShard_;
+        int shard_ = 0;
+        int games_ = 0;
+        std::ofstream file_;
+    };
+
+    template<class G>
+    std::vector<uint8_t> encodeGame(const GameLog<G> &log);
+
+    // throws std::runtime_error on a damaged shard or on games of another geometry
+    template<class G>
+    std::vector<GameLog<G>> readGames(const std::string &path, G geometry = G());
+
+    // states the actions of the game were played in
+    template<class G>
+    std::vector<game::State<G>> replayGame(const GameLog<G> &log);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdexcept>
+
+namespace game {
+    // Board size known at compile time. HEIGHT and WIDTH size the cell storage,
+    // the accessors give the playable board, which for these geometries is the same.
+    template<int Height, int Width, int Mines>
+    struct Geometry {
+        static const bool FIXED = true;
+        static const int HEIGHT = Height;
+        static const int WIDTH = Width;
+
+        static constexpr int height() {
+            return Height;
+        }
+
+        static constexpr int width() {
+            return Width;
+        }
+
+        static constexpr int mines() {
+            return Mines;
+        }
+
+        static constexpr int cells() {
+            return Height * Width;
+        }
+
+        bool operator==(const Geometry &) const {
+            return true;
+        }
+    };
+
+    using Beginner = Geometry<9, 9, 10>;
+    using Intermediate = Geometry<16, 16, 40>;
+    using Expert = Geometry<16, 30, 99>;
+
+    // Board size chosen at runtime, played in the top left corner of a HEIGHT x WIDTH storage.
+    class Custom {
+    public:
+        static const bool FIXED = false;
+        static const int HEIGHT = 32;
+        static const int WIDTH = 32;
+
+        Custom() : Custom(Expert::height(), Expert::width(), Expert::mines()) {}
+
+        Custom(int height, int width, int mines) : height_(height), width_(width), mines_(mines) {
+            if (height <= 0 || height > HEIGHT || width <= 0 || width > WIDTH || mines < 0 ||
+                mines >= height * width) {
+                throw std::invalid_argument("unsupported board geometry");
+            }
+        }
+
+        int height() const {
+            return height_;
+        }
+
+        int width() const {
+            return width_;
+        }
+
+        int mines() const {
+            return mines_;
+        }
+
+        int cells() const {
+            return height_ * width_;
+        }
+
+        bool operator==(const Custom &other) const {
+            return height_ == other.height_ && width_ == other.width_ && mines_ == other.mines_;
+        }
+
+    private:
+        int height_;
+        int width_;
+        int mines_;
+    };
+}
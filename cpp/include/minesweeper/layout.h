@@ -0,0 +1,43 @@
+#pragma once
+
+#include <random>
+
+#include "state.h"
+
+namespace game {
+    // Floyd's algorithm: k distinct indices of [0, n) in exactly k draws, every subset as likely, set in mask
+    // as the cells cellOf maps them to. mask must not hold any of those cells beforehand
+    template<class Mask, class CellOf>
+    void sampleCells(int n, int k, std::mt19937 &gen, Mask &mask, CellOf cellOf) {
+        for (int last = n - k; last < n; ++last) {
+            auto cell = cellOf(std::uniform_int_distribution<>(0, last)(gen));
+            if (mask.test(cell.first, cell.second)) {
+                cell = cellOf(last);
+            }
+            mask.set(cell.first, cell.second);
+        }
+    }
+
+    enum class FirstClick {
+        Cell,       // the first opened cell is never a mine
+        Opening     // neither are its neighbors, so the first click opens an area
+    };
+
+    // Uniform mine layouts of a geometry, drawn without a list of the cells and without shuffling all of them.
+    // An opening the board has no room for falls back to keeping the clicked cell clear
+    template<class G>
+    class LayoutGenerator {
+    public:
+        explicit LayoutGenerator(G geometry = G(), FirstClick firstClick = FirstClick::Cell)
+                : geometry_(geometry), firstClick_(firstClick) {}
+
+        typename State<G>::Mask generate(std::mt19937 &gen) const;
+
+        // layout with the first click at (i, j)
+        typename State<G>::Mask generate(std::mt19937 &gen, int i, int j) const;
+
+    private:
+        G geometry_;
+        FirstClick firstClick_;
+    };
+}
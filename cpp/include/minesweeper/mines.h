@@ -1,6 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <limits>
+#include <list>
+#include <optional>
+#include <random>
 #include <utility>
 #include <vector>
 #include <unordered_map>
@@ -18,7 +24,87 @@ namespace game {
         std::vector<std::pair<int, int>> coordinates;
     };
 
-    Constraint getMineConstraints(const State &state);
+    // One component of a ConstraintMatrix, read in place: row r places mines[r] mines among the variables
+    // variables[rowStart[r]] .. variables[rowStart[r + 1] - 1], which count from 0 and name coordinates[variable]
+    struct ConstraintView {
+        const int *rowStart;    // rows + 1 offsets into variables
+        const int *variables;
+        const int *mines;
+        const std::pair<int, int> *coordinates;  // null for bare groups
+        int rows;
+        int cells;
+
+        int rowSize(int r) const {
+            return rowStart[r + 1] - rowStart[r];
+        }
+    };
+
+    // Constraints as one compressed sparse row matrix. The rows and cells of a component are contiguous,
+    // its variables count from 0 and name the cells coordinates[cellBegin + variable]
+    struct ConstraintMatrix {
+        struct Component {
+            int rowBegin, rowEnd;
+            int cellBegin, cellEnd;
+        };
+
+        ConstraintMatrix() = default;
+
+        // bare groups without coordinates, their cells are the variables up to the largest one
+        explicit ConstraintMatrix(const std::vector<Group> &groups);
+
+        explicit ConstraintMatrix(const Constraint &constraint);
+
+        int rows() const {
+            return static_cast<int>(mines.size());
+        }
+
+        int size() const {
+            return static_cast<int>(components.size());
+        }
+
+        ConstraintView getView(int component) const;
+
+        // the component as a constraint of its own
+        Constraint getConstraint(int component) const;
+
+        std::vector<int> rowStart = {0};
+        std::vector<int> variables;
+        std::vector<int> mines;
+        std::vector<std::pair<int, int>> coordinates;
+        std::vector<Component> components;  // the whole matrix until it is split
+    };
+
+    // appends the row of the opened cell (i, j) over the cells around it, numbered by index
+    template<class G>
+    void addConstraintRow(ConstraintMatrix &matrix, const State<G> &state, const typename State<G>::Mask &cells,
+                          const std::array<int, G::HEIGHT * G::WIDTH> &index, int i, int j) {
+        for (int n = std::max(i - 1, 0); n < std::min(i + 2, state.height()); ++n) {
+            for (int m = std::max(j - 1, 0); m < std::min(j + 2, state.width()); ++m) {
+                if (cells.test(n, m)) {
+                    matrix.variables.push_back(index[n * G::WIDTH + m]);
+                }
+            }
+        }
+        matrix.rowStart.push_back(static_cast<int>(matrix.variables.size()));
+        matrix.mines.push_back(getMineCount(state, i, j) - state.flagged().countAround(i, j));
+    }
+
+    // rows of the state's opened cells over its frontier, numbered through a dense index of the board
+    template<class G>
+    ConstraintMatrix getConstraintMatrix(const State<G> &state);
+
+    // regroups a matrix with coordinates in place into the components no row joins, found by union-find and
+    // ordered by their first cell. Cells no row reaches are dropped
+    void splitComponents(ConstraintMatrix &matrix);
+
+    // the state's matrix split into its components
+    template<class G>
+    ConstraintMatrix getComponentMatrix(const State<G> &state);
+
+    template<class G>
+    Constraint getMineConstraints(const State<G> &state);
+
+    std::vector<Constraint> decoupleMineConstraints(ConstraintMatrix matrix);
 
     std::vector<Constraint> decoupleMineConstraints(const Constraint& constraint);
 
@@ -26,25 +112,171 @@ namespace game {
         std::vector<bool> variables;
     };
 
+    // the solvers below work on a view of a component, the overloads taking groups flatten them first
+
+    std::vector<Variant> getMineVariants(const ConstraintView &constraints);
+
     std::vector<Variant> getMineVariants(const std::vector<Group> &constraints);
 
+    // Variants of a constraint counted by the number of mines they place, without listing them.
+    // variants[m] - how many variants have m mines, cellMines[m * cells + i] - how many of those
+    // have a mine in cell i, where cells + 1 == variants.size()
+    struct VariantCount {
+        std::vector<double> variants;
+        std::vector<double> cellMines;
+    };
+
+    VariantCount countMineVariants(const ConstraintView &constraints);
+
+    VariantCount countMineVariants(const std::vector<Group> &constraints);
+
+    VariantCount countVariants(const std::vector<Variant> &variants, int size);
+
+    // for every cell of a constraint 0 - no variant has a mine there, 1 - every variant has, -1 - undecided
+    std::vector<int> getMineBackbone(const ConstraintView &constraints);
+
+    std::vector<int> getMineBackbone(const std::vector<Group> &constraints);
+
+    struct ComponentKeyHash {
+        size_t operator()(const std::vector<int> &key) const noexcept;
+    };
+
+    // Bounded least recently used cache of component solutions. Components are keyed by their groups
+    // with the cells relabelled in order of first appearance, so a component that survives a move
+    // is solved once however many times it is asked for.
+    class ComponentCache {
+    public:
+        explicit ComponentCache(size_t capacity = 1024) : capacity_(capacity) {}
+
+        VariantCount getCounts(const ConstraintView &constraints);
+
+        VariantCount getCounts(const std::vector<Group> &constraints);
+
+        std::vector<int> getBackbone(const ConstraintView &constraints);
+
+        std::vector<int> getBackbone(const std::vector<Group> &constraints);
+
+        size_t size() const {
+            return entries_.size();
+        }
+
+        size_t capacity() const {
+            return capacity_;
+        }
+
+        // share of the lookups answered without solving
+        double getHitRate() const {
+            return lookups_ ? static_cast<double>(hits_) / static_cast<double>(lookups_) : 0;
+        }
+
+        void clear();
+
+    private:
+        struct Entry {
+            std::vector<int> key;
+            std::optional<VariantCount> counts;
+            std::optional<std::vector<int>> backbone;
+        };
+
+        // entry of the component, labels[var] - the variable of the key standing for var
+        Entry &find(const ConstraintView &constraints, std::vector<int> &labels);
+
+    private:
+        size_t capacity_;
+        size_t hits_ = 0;
+        size_t lookups_ = 0;
+
+        std::list<Entry> entries_;
+        std::unordered_map<std::vector<int>, std::list<Entry>::iterator, ComponentKeyHash> index_;
+    };
+
+    // cache of the calling thread, shared by the solvers and analyzeState
+    ComponentCache &getComponentCache();
+
+    // log n! for every n up to the cells of the largest board storage, filled once on first use
+    const std::vector<double> &getLogFactorials();
+
+    // log of the number of ways to place k mines in n cells, -infinity when there are none
+    inline double getLogBinomial(int n, int k) {
+        if (k < 0 || k > n) {
+            return -std::numeric_limits<double>::infinity();
+        }
+        const auto &logFactorials = getLogFactorials();
+        return logFactorials[n] - logFactorials[k] - logFactorials[n - k];
+    }
+
+    // ways to place each of leftMines in leftSpace cells, relative to the likeliest of them
     std::vector<double> getPositionScore(const std::vector<int> &leftMines, int leftSpace);
 
+    // product of two polynomials in the number of mines, scaled to a largest coefficient of 1
+    std::vector<double> convolveMines(const std::vector<double> &lhs, const std::vector<double> &rhs);
+
+    // Walker's alias method, draws an index of a discrete distribution with one uniform index and one
+    // uniform real whatever the number of outcomes
+    class AliasTable {
+    public:
+        AliasTable() = default;
+
+        explicit AliasTable(const std::vector<double> &weights);
+
+        int sample(std::mt19937 &gen) const {
+            int k = std::uniform_int_distribution<>(0, static_cast<int>(probability_.size()) - 1)(gen);
+            return std::uniform_real_distribution<>()(gen) < probability_[k] ? k : alias_[k];
+        }
+
+        size_t size() const {
+            return probability_.size();
+        }
+
+    private:
+        std::vector<double> probability_;
+        std::vector<int> alias_;
+    };
+
+    enum class AnalysisMode {
+        Variants,   // lists every variant, boards can be sampled from the analysis
+        Counts      // only counts them, for probabilities of positions with huge frontiers
+    };
+
+    template<class G>
     struct StateAnalysis {
         struct VariantGroup {
-            std::vector<int> indices;
+            std::vector<int> indices;   // empty when the variants were only counted
             int mines;
+            double count;
         };
 
-        State state;
+        State<G> state;
 
         std::vector<std::vector<std::pair<int, int>>> coordinates;
         std::vector<std::vector<Variant>> variants;
+        std::vector<VariantCount> counts;
         std::vector<std::vector<VariantGroup>> condensedVariants;
 
-        std::vector<std::vector<int>> condensedVariantsIndices;
-        std::vector<double> condensedVariantsProbability;
+        // componentMines[n][s] - weight of the first n components placing s mines between them, the
+        // convolution of their mine counts scaled to a largest coefficient of 1
+        std::vector<std::vector<double>> componentMines;
+        // probability of s mines on the whole frontier, the interior holding the rest
+        std::vector<double> frontierMinesProbability;
+        AliasTable frontierMinesTable;
+
+        // unknown cells no constraint reaches, they share the mines the components leave over
+        std::vector<std::pair<int, int>> interior;
+
+        // probability of a mine in every cell, i * G::WIDTH + j
+        std::vector<double> mineProbability;
     };
 
-    StateAnalysis analyzeState(const State& state);
+    // throws std::invalid_argument when no mine layout agrees with the state
+    template<class G>
+    StateAnalysis<G> analyzeState(const State<G> &state, AnalysisMode mode = AnalysisMode::Variants);
+
+    // mine layout drawn from the positions consistent with the analysed state, as likely as they are.
+    // Takes an analysis of AnalysisMode::Variants
+    template<class G>
+    typename State<G>::Mask sampleMines(const StateAnalysis<G> &analysis, std::mt19937 &gen);
+
+    // n layouts of sampleMines one after another, height x width bytes each, 1 for a mine
+    template<class G>
+    void sampleLayouts(const StateAnalysis<G> &analysis, int n, std::mt19937 &gen, uint8_t *layouts);
 }
\ No newline at end of file
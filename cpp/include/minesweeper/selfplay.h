@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "agent.h"
+#include "gamelog.h"
+#include "threadpool.h"
+
+namespace agent {
+    // Self-play games of tree agents that wait on a network for their policies and values. The games are
+    // advanced by a pool of threads, each game with a generator of its own, so a game plays out the same
+    // whatever the number of threads. Games come in two halves taking turns: while the caller evaluates the
+    // batch of one half, the workers already search the other one.
+    template<class G>
+    class SelfPlay {
+    public:
+        SelfPlay(int batchSize, int treeIter, int threads, G geometry = G(),
+                 uint32_t seed = std::mt19937::default_seed);
+
+        // Batches live in buffers of the self-play, one set per half, the workers write the states and their
+        // legal action masks straight into them and the network writes its policies and values back.
+
+        // waits for the workers to finish the next batch and returns its half, the buffers of that half
+        // belong to the caller until the batch is loaded. Rethrows an exception a worker threw, the game
+        // it was advancing is left half done, so every later call throws it again
+        int getBatch();
+
+        // batchSize x height x width each
+        const uint8_t *getStates(int half) const {
+            return states_[half].data();
+        }
+
+        // 1 where opening the cell is a legal action
+        const uint8_t *getMasks(int half) const {
+            return masks_[half].data();
+        }
+
+        float *getPolicy(int half) {
+            return policy_[half].data();
+        }
+
+        float *getValues(int half) {
+            return values_[half].data();
+        }
+
+        // hands the policies and values in the buffers of the batch to its games, throws std::logic_error
+        // unless getBatch handed that batch over since the last load
+        void loadBatch();
+
+        // the same with copies, policy and values may also be the buffers themselves
+        void getBatch(uint8_t *states);
+
+        void loadBatch(const float *policy, const float *values);
+
+        int getBatchSize() const {
+            return batchSize_;
+        }
+
+        // games played to the end so far
+        int getFinishedGames();
+
+        // from now on finished games are appended to shards of prefix, before that they are only counted.
+        // Throws when the first shard cannot be opened
+        void setLog(const std::string &prefix, int gamesPerShard = 1 << 12);
+
+    private:
+        enum class Task {
+            Initialize,
+            Update
+        };
+
+        struct Game {
+            Game(uint32_t seed, G geometry) : gen(seed), agent(gen), board(gen, geometry) {}
+
+            std::mt19937 gen;
+            TreeAgent<G> agent;
+            LoggingBoard<G> board;
+
+            // state waiting for its evaluation
+            Task task;
+            game::State<G> state;
+        };
+
+        // plays and searches a game until it needs the network
+        void prepare(Game &game);
+
+        void advance(Game &game, const float *policy, float value);
+
+        void checkOwned() const;
+
+        void submit(int half, std::function<void(int)> task);
+
+        // writes the state waiting in game into slot k of the buffers of half
+        void publish(const Game &game, int half, int k);
+
+        G geometry_;
+        int batchSize_;
+        int treeIter_;
+        std::vector<std::unique_ptr<Game>> games_;  // agents and boards refer to the generator of their game
+
+        // the half whose batch goes out next, the buffers of each half and its unfinished games
+        int current_ = 0;
+        bool owned_ = false;    // getBatch handed the current half to the caller
+        std::array<std::vector<uint8_t>, 2> states_;
+        std::array<std::vector<uint8_t>, 2> masks_;
+        std::array<std::vector<float>, 2> policy_;
+        std::array<std::vector<float>, 2> values_;
+        std::array<int, 2> pending_ = {0, 0};
+
+        std::mutex mutex_;
+        std::condition_variable done_;
+        std::unique_ptr<GameWriter<G>> writer_;
+        std::exception_ptr error_;  // first exception of a worker
+        int finished_ = 0;
+
+        ThreadPool pool_;
+    };
+}
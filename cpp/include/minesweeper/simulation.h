@@ -4,6 +4,8 @@
 #include <random>
 #include <memory>
 
+#include "frontier.h"
+#include "layout.h"
 #include "mines.h"
 
 namespace game {
@@ -15,7 +17,21 @@ namespace game {
 
     double getReward(GameResult result);
 
-    GameResult getStateResult(const State &state);
+    template<class G>
+    GameResult getStateResult(const State<G> &state);
+
+    template<class G>
+    class Board;
+
+    template<class G>
+    class PerfectBoard;
+
+    // same as getStateResult of the board's state, read off the board's counters
+    template<class G>
+    GameResult getStateResult(const Board<G> &board);
+
+    template<class G>
+    GameResult getStateResult(const PerfectBoard<G> &board);
 
     bool isTerminal(GameResult result);
 
@@ -29,14 +45,38 @@ namespace game {
         Cell cell;
     };
 
-    std::vector<Action> getPossibleActions(const State &state);
+    // Action in 16 bits, the cell index i * width + j times 2, plus 1 for a flag. Ids kept in memory count
+    // rows G::WIDTH apart, ids written for a played board use its width
+    using ActionId = uint16_t;
+
+    inline ActionId packAction(const Action &action, int width) {
+        return static_cast<ActionId>(((action.i * width + action.j) << 1) | action.cell);
+    }
+
+    inline Action unpackAction(ActionId id, int width) {
+        int index = id >> 1;
+        return Action{index / width, index % width, Cell(id & 1)};
+    }
+
+    // opening any cell of state.unknown() is legal, these list them in row major order
+    template<class G>
+    std::vector<Action> getPossibleActions(const State<G> &state);
+
+    // the same as ids into actions, which has room for state.unknown().count() of them, returns how many
+    template<class G>
+    int getPossibleActions(const State<G> &state, ActionId *actions);
 
+    template<class G>
     class Board {
     public:
-        explicit Board(std::mt19937 &gen);
+        using Mask = typename State<G>::Mask;
 
-        Board(const Board &board) : state_(board.state_), open_(board.open_), gen_(board.gen_),
-                                    openedCells_(board.openedCells_), clear_(board.clear_) {
+        explicit Board(std::mt19937 &gen, G geometry = G());
+
+        Board(const Board &board) : state_(board.state_), open_(board.open_), frontier_(board.frontier_),
+                                    gen_(board.gen_), empty_(board.empty_), lastOpened_(board.lastOpened_),
+                                    openedCells_(board.openedCells_), flaggedCells_(board.flaggedCells_),
+                                    lost_(board.lost_), clear_(board.clear_) {
         }
 
         Board &operator=(const Board &board) {
@@ -44,35 +84,78 @@ namespace game {
             return *this;
         }
 
-        Board(Board &&board) : state_(std::move(board.state_)), open_(std::move(board.open_)), gen_(board.gen_),
-                               openedCells_(board.openedCells_), clear_(board.clear_) {
+        Board(Board &&board) : state_(std::move(board.state_)), open_(std::move(board.open_)),
+                               frontier_(std::move(board.frontier_)), gen_(board.gen_), empty_(board.empty_),
+                               lastOpened_(board.lastOpened_), openedCells_(board.openedCells_),
+                               flaggedCells_(board.flaggedCells_), lost_(board.lost_), clear_(board.clear_) {
         }
 
         Board &operator=(Board &&board) {
             state_ = std::move(board.state_);
             open_ = std::move(board.open_);
+            frontier_ = std::move(board.frontier_);
             gen_ = board.gen_;
+            empty_ = board.empty_;
+            lastOpened_ = board.lastOpened_;
             openedCells_ = board.openedCells_;
+            flaggedCells_ = board.flaggedCells_;
+            lost_ = board.lost_;
             clear_ = board.clear_;
             return *this;
         }
 
-        Board(std::mt19937 &gen, const StateAnalysis &analysis);
+        Board(std::mt19937 &gen, const StateAnalysis<G> &analysis);
+
+        // board on the given mine layout, the first open keeps it instead of drawing a new one
+        Board(std::mt19937 &gen, G geometry, const Mask &mines);
 
         GameResult act(Action action);
 
-        const State &getState() const;
+        const State<G> &getState() const;
 
-    private:
-        void setMineCount(int i, int j, int count);
+        // counters kept up as cells get opened and flagged, they answer what getStateResult
+        // would find by looking at the whole state
+
+        int getOpenedCells() const {
+            return openedCells_;
+        }
+
+        int getFlaggedCells() const {
+            return flaggedCells_;
+        }
+
+        bool isLost() const {
+            return lost_;
+        }
+
+        uint64_t getHash() const {
+            return open_.hash();
+        }
+
+        // layout of the mines, empty until the first open draws it
+        const Mask &getMines() const {
+            return state_.mines();
+        }
+
+        // cells the last action opened, for whoever patches its own copy of the state
+        const Mask &getLastOpened() const {
+            return lastOpened_;
+        }
+
+        GameResult getResult() const;
 
-        int countNeighborMines(int i, int j) const;
+        // decoupled constraints of the visible state, kept up to date as cells get opened and flagged
+        const std::vector<Constraint> &getConstraints();
 
-        void populateMines(std::vector<std::pair<int, int>> indices, int mines);
+        std::vector<Constraint> getChangedConstraints();
+
+    private:
+        void setLayout(const Mask &mines);
 
         void restart(int i, int j);
 
-        void openNeighborhood(int i, int j);
+        // opens the seeds that are not mines and floods through the empty cells among them
+        void openArea(const Mask &seeds);
 
         void openCell(int i, int j);
 
@@ -83,25 +166,43 @@ namespace game {
         void flag(int i, int j);
 
     private:
-        State state_;
-        State open_;
+        State<G> state_;
+        State<G> open_;
+        Frontier<G> frontier_;
         std::mt19937 &gen_;
+        Mask empty_;  // cells of the layout without a mine around
+        Mask lastOpened_;
 
         int openedCells_ = 0;
+        int flaggedCells_ = 0;
+        bool lost_ = false;
         bool clear_ = true;
     };
 
+    template<class G>
     class PerfectBoard {
     public:
-        explicit PerfectBoard(std::mt19937 &gen);
+        explicit PerfectBoard(std::mt19937 &gen, G geometry = G());
 
-        PerfectBoard(std::mt19937 &gen, const StateAnalysis &analysis);
+        PerfectBoard(std::mt19937 &gen, const StateAnalysis<G> &analysis);
 
         GameResult act(Action action);
 
-        const State &getState() const;
+        const State<G> &getState() const;
+
+        const Board<G> &getBoard() const {
+            return board_;
+        }
+
+        GameResult getResult() const {
+            return board_.getResult();
+        }
+
+        uint64_t getHash() const {
+            return board_.getHash();
+        }
 
     private:
-        Board board_;
+        Board<G> board_;
     };
 }
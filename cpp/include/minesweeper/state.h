@@ -1,51 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <cstring>
+#include <functional>
 
-namespace game {
-    const static int HEIGHT = 16;//16;
-    const static int WIDTH = 30;//30;
-    const static int MINES = 99;//99;
+#include "bitboard.h"
+#include "geometry.h"
 
+namespace game {
     const static int BOMB = 11;
     const static int EMPTY = 2;
     const static int FLAG = 1;
 
 // 0 - unknown, 1 - mine, n + 2 - open (n mines surrounding), 11 - true mine
 
-    using State = std::array<std::array<uint8_t, WIDTH>, HEIGHT>;
+    // Zobrist key of value in cell index, unknown cells contribute nothing so an empty grid hashes to zero.
+    // Keys are drawn by a splitmix64 step instead of a table, different seeds give independent hashes
+    inline uint64_t getZobristKey(int index, uint8_t value, uint64_t seed) {
+        if (value == 0) {
+            return 0;
+        }
+        uint64_t x = seed + (static_cast<uint64_t>(index) << 4 | value) * 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // Byte grid kept together with its bit planes. The grid is the layout shared with python,
+    // the planes serve whole-board queries. All writes go through set or setLayout so both stay in sync.
+    template<class G>
+    class State {
+    public:
+        using Geometry = G;
+        using Mask = Bitboard<G::HEIGHT>;
+        using Row = std::array<uint8_t, G::WIDTH>;
+
+        State() = default;
+
+        explicit State(G geometry) : geometry_(geometry) {}
+
+        const Row &operator[](int i) const {
+            return cells_[i];
+        }
+
+        void set(int i, int j, uint8_t value) {
+            if (hashed_) {
+                int index = i * G::WIDTH + j;
+                hash_ ^= getZobristKey(index, cells_[i][j], HASH_SEED) ^ getZobristKey(index, value, HASH_SEED);
+                check_ ^= getZobristKey(index, cells_[i][j], CHECK_SEED) ^ getZobristKey(index, value, CHECK_SEED);
+            }
+            cells_[i][j] = value;
+            opened_.assign(i, j, value >= EMPTY);
+            flagged_.assign(i, j, value == FLAG);
+            mines_.assign(i, j, value == BOMB);
+        }
+
+        // Turns the whole board into the hidden board of a mine layout, mines and the mine counts of every
+        // other cell, eight cells of a row at a time. The hashes are left until asked for, hidden boards never are
+        void setLayout(const Mask &mines) {
+            const uint64_t bytes = 0x0101010101010101;
+            auto counts = countNeighbors(mines);
+            for (int i = 0; i < height(); ++i) {
+                uint32_t row = mines.row(i);
+                uint32_t c0 = counts[0].row(i), c1 = counts[1].row(i), c2 = counts[2].row(i), c3 = counts[3].row(i);
+                for (int j = 0; j < width(); j += 8) {
+                    uint64_t count = spreadBits(c0 >> j) | spreadBits(c1 >> j) << 1 | spreadBits(c2 >> j) << 2 |
+                                     spreadBits(c3 >> j) << 3;
+                    uint64_t bomb = spreadBits(row >> j) * 0xff;
+                    uint64_t cells = ((count + EMPTY * bytes) & ~bomb) | (BOMB * bytes & bomb);
+                    std::memcpy(&cells_[i][j], &cells, std::min(8, width() - j));
+                }
+            }
+            opened_ = board();  // set counts mines as opened as well
+            flagged_ = Mask();
+            mines_ = mines;
+            hashed_ = false;
+        }
+
+        // rows are G::WIDTH bytes apart, only the first width() of each are part of the board
+        const uint8_t *data() const {
+            return cells_[0].data();
+        }
+
+        const G &geometry() const {
+            return geometry_;
+        }
+
+        int height() const {
+            return geometry_.height();
+        }
+
+        int width() const {
+            return geometry_.width();
+        }
+
+        const Mask &opened() const {
+            return opened_;
+        }
+
+        const Mask &flagged() const {
+            return flagged_;
+        }
+
+        const Mask &mines() const {
+            return mines_;
+        }
+
+        // cells that are neither opened nor flagged, exactly the cells that can be acted on
+        Mask unknown() const {
+            return board() - opened_ - flagged_;
+        }
+
+        // unknown cells touching an opened cell
+        Mask frontier() const {
+            return unknown() & dilate(opened_);
+        }
+
+        Mask board() const {
+            if constexpr (G::FIXED) {
+                static const Mask board = Mask::rectangle(G::HEIGHT, G::WIDTH);
+                return board;
+            } else {
+                return Mask::rectangle(height(), width());
+            }
+        }
+
+        // Zobrist hash kept up to date by set. A state after setLayout computes it on the first call,
+        // which is not to race with other calls
+        uint64_t hash() const {
+            rehash();
+            return hash_;
+        }
+
+        // second Zobrist hash independent of the first, tells apart states whose hashes collide
+        uint64_t check() const {
+            rehash();
+            return check_;
+        }
+
+        bool operator==(const State &other) const {
+            return cells_ == other.cells_ && geometry_ == other.geometry_;
+        }
 
-    inline bool isOpened(const State &state, int i, int j) {
-        return state[i][j] >= EMPTY;
+        bool operator!=(const State &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        void rehash() const {
+            if (hashed_) {
+                return;
+            }
+            hash_ = check_ = 0;
+            for (int i = 0; i < height(); ++i) {
+                for (int j = 0; j < width(); ++j) {
+                    hash_ ^= getZobristKey(i * G::WIDTH + j, cells_[i][j], HASH_SEED);
+                    check_ ^= getZobristKey(i * G::WIDTH + j, cells_[i][j], CHECK_SEED);
+                }
+            }
+            hashed_ = true;
+        }
+
+    private:
+        static const uint64_t HASH_SEED = 0x2545f4914f6cdd1dULL;
+        static const uint64_t CHECK_SEED = 0x9fb21c651e98df25ULL;
+
+        std::array<Row, G::HEIGHT> cells_{};
+        Mask opened_;
+        Mask flagged_;
+        Mask mines_;
+        G geometry_;
+        mutable uint64_t hash_ = 0;
+        mutable uint64_t check_ = 0;
+        mutable bool hashed_ = true;
+    };
+
+    template<class G>
+    inline bool isOpened(const State<G> &state, int i, int j) {
+        return state.opened().test(i, j);
     }
 
-    inline bool isFlagged(const State &state, int i, int j) {
-        return state[i][j] == FLAG;
+    template<class G>
+    inline bool isFlagged(const State<G> &state, int i, int j) {
+        return state.flagged().test(i, j);
     }
 
-    inline int getMineCount(const State &state, int i, int j) {
+    template<class G>
+    inline int getMineCount(const State<G> &state, int i, int j) {
         return state[i][j] - EMPTY;
     }
 
-    inline bool isNeighbor(const State &state, int i, int j) {
-        for (int n = std::max(i - 1, 0); n < std::min(i + 2, HEIGHT); ++n) {
-            for (int m = std::max(j - 1, 0); m < std::min(j + 2, WIDTH); ++m) {
-                if (isOpened(state, n, m)) {
-                    return true;
-                }
-            }
-        }
-        return false;
+    template<class G>
+    inline bool isNeighbor(const State<G> &state, int i, int j) {
+        return state.opened().countAround(i, j) > 0;
     }
 }
 
-template<>
-struct std::hash<game::State> {
-    size_t operator()(const game::State &s) const noexcept {
-        size_t seed = 0;
-        for (int i = 0; i < game::HEIGHT; ++i) {
-            for (int j = 0; j < game::WIDTH; ++j) {
-                seed ^= s[i][j] + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-            }
-        }
-        return seed;
+template<class G>
+struct std::hash<game::State<G>> {
+    size_t operator()(const game::State<G> &s) const noexcept {
+        return s.hash();
     }
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace agent {
+    // Fixed set of threads working off a queue of tasks. Tasks still queued when the pool goes away are dropped
+    class ThreadPool {
+    public:
+        explicit ThreadPool(int threads);
+
+        ~ThreadPool();
+
+        // a task has to catch its own exceptions, one escaping it terminates the program
+        void submit(std::function<void()> task);
+
+        // runs task(k) for every k below count on the pool and waits for all of them, rethrows the first
+        // exception a task threw. Not to be called from a task of the same pool
+        void run(int count, const std::function<void(int)> &task);
+
+        int size() const {
+            return static_cast<int>(workers_.size());
+        }
+
+    private:
+        void work();
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable available_;
+        std::deque<std::function<void()>> tasks_;
+        std::vector<std::thread> workers_;
+        bool stopped_ = false;
+    };
+}
@@ -1,102 +1,363 @@
 #pragma once
 
-#include <unordered_set>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
 
 #include "mines.h"
 #include "simulation.h"
 
 namespace tree {
+    // Hash map split into shards with a lock each, workers of a parallel search only wait
+    // for each other when they touch the same shard
+    template<class Key, class Value, class Hash = std::hash<Key>>
+    class ConcurrentMap {
+    private:
+        static const int SHARDS = 64;
+
+        struct Shard {
+            Shard() = default;
+
+            Shard(const Shard &shard) : map(shard.map) {}
+
+            Shard(Shard &&shard) noexcept: map(std::move(shard.map)) {}
+
+            Shard &operator=(const Shard &shard) {
+                map = shard.map;
+                return *this;
+            }
+
+            Shard &operator=(Shard &&shard) noexcept {
+                map = std::move(shard.map);
+                return *this;
+            }
+
+            mutable std::mutex mutex;
+            std::unordered_map<Key, Value, Hash> map;
+        };
+
+    public:
+        // value stored under key, missing if there is none
+        Value find(const Key &key, Value missing = Value()) const {
+            const auto &shard = shards_[getShard(key)];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.map.find(key);
+            return it == shard.map.end() ? missing : it->second;
+        }
+
+        // stores value unless key is already present, returns whatever is stored under key afterwards
+        Value insert(const Key &key, Value value) {
+            auto &shard = shards_[getShard(key)];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            return shard.map.emplace(key, value).first->second;
+        }
+
+        // the rest is not to be called while other threads use the map
+
+        template<class F>
+        void forEach(F f) const {
+            for (const auto &shard: shards_) {
+                for (const auto &[key, value]: shard.map) {
+                    f(key, value);
+                }
+            }
+        }
+
+        void clear() {
+            for (auto &shard: shards_) {
+                shard.map.clear();
+            }
+        }
+
+    private:
+        static size_t getShard(const Key &key) {
+            return Hash()(key) % SHARDS;
+        }
+
+    private:
+        std::array<Shard, SHARDS> shards_;
+    };
+
+    // Append-only storage addressed by offset. Chunks double in size and never move, so items stay
+    // in place while others are allocated, and a block of at most BASE items is always contiguous.
+    // Allocation is not synchronized, everything is freed at once with the arena.
+    template<class T>
+    class Arena {
+    private:
+        static const int SHIFT = 11;
+        static const int BASE = 1 << SHIFT;
+        static const int CHUNKS = 20;
+
+    public:
+        Arena() = default;
+
+        Arena(const Arena &arena) : size_(arena.size_) {
+            for (int k = 0; k < CHUNKS && arena.chunks_[k]; ++k) {
+                chunks_[k].reset(new T[getChunkSize(k)]);
+                std::copy(arena.chunks_[k].get(), arena.chunks_[k].get() + getChunkSize(k), chunks_[k].get());
+            }
+        }
+
+        Arena(Arena &&arena) noexcept: chunks_(std::move(arena.chunks_)), size_(std::exchange(arena.size_, 0)) {}
+
+        Arena &operator=(const Arena &arena) {
+            return *this = Arena(arena);
+        }
+
+        Arena &operator=(Arena &&arena) noexcept {
+            std::swap(chunks_, arena.chunks_);
+            std::swap(size_, arena.size_);
+            return *this;
+        }
+
+        // offset of count consecutive default initialized items, count is at most BASE
+        int allocate(int count) {
+            int chunk = getChunk(size_);
+            if (count > 0 && getChunk(size_ + count - 1) != chunk) {
+                size_ = getChunkStart(++chunk);
+            }
+            if (!chunks_[chunk]) {
+                chunks_[chunk].reset(new T[getChunkSize(chunk)]());
+            }
+            int offset = size_;
+            size_ += count;
+            return offset;
+        }
+
+        T &operator[](int offset) {
+            return *data(offset);
+        }
+
+        const T &operator[](int offset) const {
+            return *data(offset);
+        }
+
+        // items of a block are contiguous
+        T *data(int offset) {
+            int chunk = getChunk(offset);
+            return chunks_[chunk].get() + (offset - getChunkStart(chunk));
+        }
+
+        const T *data(int offset) const {
+            int chunk = getChunk(offset);
+            return chunks_[chunk].get() + (offset - getChunkStart(chunk));
+        }
+
+        int size() const {
+            return size_;
+        }
+
+    private:
+        static int getChunk(int offset) {
+            return 31 - __builtin_clz((offset >> SHIFT) + 1);
+        }
+
+        static int getChunkStart(int chunk) {
+            return BASE * ((1 << chunk) - 1);
+        }
+
+        static int getChunkSize(int chunk) {
+            return BASE << chunk;
+        }
+
+    private:
+        std::array<std::unique_ptr<T[]>, CHUNKS> chunks_;
+        int size_ = 0;
+    };
+
+    template<class G>
     class Tree {
     private:
         const double CPUCT = 1;
         const int MAXITER = 10;
+        // a descent counts as lost on every edge it passes until its value is backed up,
+        // which steers parallel workers away from each other's paths
+        const float VIRTUAL_LOSS = 1;
 
+        // Nodes and their edges live in arenas and refer to each other by offset. The edges of a node
+        // are a contiguous block of each edge array, workers of a parallel search update their
+        // statistics with atomic builtins.
         struct Node {
-            game::State state;
+            int edges;
+            int size;
+            int children = -1;  // head of the list of child links
+            float value;
+            bool terminal;
+            char lock = 0;
+        };
 
-            std::vector<game::Action> actions;
-            std::vector<int> nVisits;
-            std::vector<double> qValues;
+        struct Link {
+            int node;
+            int next;
+        };
 
-            std::vector<double> policy;
-            double value;
-            bool terminal;
+        // descents back up along the edges they took, a node reached from several parents only
+        // changes the statistics of the edges that actually led to it
+        struct Step {
+            int node;
+            int edge;
+        };
 
-            Node *parent = nullptr;
-            int parentActionIndex;
-            std::unordered_set<Node *> children;
+        // states are keyed by their Zobrist hash, the second hash detects collisions
+        struct Entry {
+            int node = -1;
+            uint64_t check = 0;
+        };
+
+        struct Storage {
+            Arena<Node> nodes;
+            Arena<game::ActionId> actions;
+            Arena<int> visits;
+            Arena<float> values;  // sum of the values backed up through each edge
+            Arena<float> priors;
+            Arena<Link> links;
         };
 
     public:
+        struct SearchStats {
+            int threads = 0;
+            int iterations = 0;
+            int descents = 0;
+            double seconds = 0;
+        };
+
+        // policy and value of the state a descent stopped at, with the generator of the calling worker
+        using Evaluator = std::function<std::pair<std::vector<double>, double>(const game::PerfectBoard<G> &,
+                                                                               std::mt19937 &)>;
+
         explicit Tree(std::mt19937 &gen) : gen_(gen) {}
 
-        Tree(const Tree &tree) : rootAnalysis_(tree.rootAnalysis_), gen_(tree.gen_) {
-            root_ = copyNode(tree.root_, nullptr, states_);
-            updated_ = states_[tree.updated_->state];
-        }
+        Tree(const Tree &tree) = default;
 
         Tree &operator=(const Tree &tree) {
             return *this = Tree(tree);
         }
 
-        Tree(Tree &&tree) : states_(std::move(tree.states_)), rootAnalysis_(std::move(tree.rootAnalysis_)),
-                            gen_(tree.gen_), root_(tree.root_), updated_(tree.updated_) {
-        }
+        Tree(Tree &&tree) = default;
 
         Tree &operator=(Tree &&tree) {
+            std::swap(storage_, tree.storage_);
             std::swap(states_, tree.states_);
             std::swap(rootAnalysis_, tree.rootAnalysis_);
             gen_ = tree.gen_;
             root_ = tree.root_;
             updated_ = tree.updated_;
+            path_ = std::move(tree.path_);
             return *this;
         }
 
-        ~Tree() {
-            for (const auto &[_, node]: states_) {
-                delete node;
-            }
-        }
+        // keeps the part of the tree below state and frees the rest at once
+        void moveto(game::State<G> state, std::vector<double> policy);
 
-        void moveto(game::State state, std::vector<double> policy);
+        // same with the analysis of the new root computed by the caller, so trees at one root share it
+        void moveto(game::StateAnalysis<G> analysis, const std::vector<double> &policy);
 
-        game::PerfectBoard explore();
+        game::PerfectBoard<G> explore();
 
         void updateNode(std::vector<double> policy, double value);
 
+        // runs iterations of explore and update on threads workers sharing this tree, every worker
+        // with a generator of its own seeded from the tree's one
+        SearchStats search(int iterations, int threads, const Evaluator &evaluate);
+
         game::Action sampleAction() const;
 
-        Node *getUpdatedNode() const {
-            return updated_;
+        const game::State<G> &getRootState() const {
+            return rootAnalysis_.state;
         }
 
-        Node *getRoot() const {
-            return root_;
+        std::vector<game::Action> getRootActions() const;
+
+        std::vector<int> getRootVisits() const;
+
+        int size() const {
+            return storage_.nodes.size();
+        }
+
+        // lookups that met a different state under the same hash, those are treated as misses
+        int getCollisions() const {
+            return collisions_;
         }
 
     private:
-        Node *createNode(const game::State &state, Node *parent, int parentActionIndex);
+        // result is the game result of state, boards keep it at hand
+        int createNode(const game::State<G> &state, game::GameResult result, std::mt19937 &gen);
 
-        Node *copyNode(Node* node, Node* parent, std::unordered_map<game::State, Node*>& states) {
-            auto copy = new Node(*node);
-            states[copy->state] = copy;
-            copy->children.clear();
-            copy->parent = parent;
+        // node of state, -1 if there is none
+        int findNode(const game::State<G> &state);
 
-            for (auto child: node->children) {
-                copy->children.insert(copyNode(child, copy, states));
-            }
+        // publishes node unless state already has one, returns the node state ends up with. A node
+        // whose hash is taken by another state is left unpublished
+        int insertNode(const game::State<G> &state, int node);
 
-            return copy;
-        }
+        void setPolicy(int node, const std::vector<double> &policy);
+
+        // follows the best actions from the root and plays them on board until it either leaves the tree,
+        // then it returns -1, or reaches a terminal node
+        int descend(game::PerfectBoard<G> &board, std::vector<Step> &path, bool virtualLoss);
 
-        void propagateValue(Node *node, double value);
+        // offset of the best edge of node
+        int selectAction(int node) const;
+
+        // links child below parent unless it already is
+        void addChild(int parent, int child);
+
+        void backup(const std::vector<Step> &path, float value, bool virtualLoss);
+
+        // one explore and update of a parallel search, returns the number of descents it took
+        int iterate(std::mt19937 &gen, std::vector<Step> &path, const Evaluator &evaluate);
 
     private:
-        std::unordered_map<game::State, Node *> states_;
-        game::StateAnalysis rootAnalysis_;
+        Storage storage_;
+        char allocation_ = 0;  // lock of the arenas
+        ConcurrentMap<uint64_t, Entry> states_;
+        game::StateAnalysis<G> rootAnalysis_;
         std::mt19937 &gen_;
-        Node *root_ = nullptr;
-        Node *updated_ = nullptr;
+        int root_ = -1;
+        int updated_ = -1;
+        std::vector<Step> path_;
+        int collisions_ = 0;
+    };
+
+    // Independent trees standing at the same root, each drawing its determinizations from a generator
+    // of its own, so they can be searched on separate threads. Their root visits are merged before
+    // an action is sampled. A single tree uses the given generator directly.
+    template<class G>
+    class Ensemble {
+    public:
+        Ensemble(std::mt19937 &gen, int size);
+
+        void moveto(const game::State<G> &state, const std::vector<double> &policy);
+
+        // root visits summed over the trees
+        std::vector<int> getRootVisits() const;
+
+        game::Action sampleAction() const;
+
+        int size() const {
+            return static_cast<int>(trees_.size());
+        }
+
+        Tree<G> &operator[](int i) {
+            return trees_[i];
+        }
+
+        const Tree<G> &operator[](int i) const {
+            return trees_[i];
+        }
+
+        std::mt19937 &getGenerator(int i) const {
+            return gens_ ? (*gens_)[i] : *gen_;
+        }
+
+    private:
+        std::mt19937 *gen_;
+        // shared by copies, the trees of a copy keep referring to the same generators
+        std::shared_ptr<std::vector<std::mt19937>> gens_;
+        std::vector<Tree<G>> trees_;
     };
 }
@@ -1,137 +1,269 @@
 #include "agent.h"
-#include "utils.h"
+#include "elimination.h"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <numeric>
 
 namespace agent {
     using namespace game;
 
-    std::vector<game::Action> getExactActionsWeak(const game::State &state) {
-        std::vector<Action> actions;
-        for (const auto& [constraints, coordinates]: decoupleMineConstraints(getMineConstraints(state))) {
-            int rows = static_cast<int>(constraints.size());
-            int columns = static_cast<int>(coordinates.size());
+    std::vector<game::Action> getExactActionsWeak(const game::ConstraintView &component) {
+        thread_local EliminationWorkspace workspace;
+        thread_local std::vector<std::pair<int, bool>> forced;
+
+        int rows = component.rows;
+        int columns = component.cells;
+        if (rows == 0 || columns == 0) {
+            return {};
+        }
 
-            if (rows == 0 || columns == 0) {
-                return {};
+        workspace.reset(rows, columns);
+        for (int i = 0; i < rows; ++i) {
+            for (int k = component.rowStart[i]; k < component.rowStart[i + 1]; ++k) {
+                workspace.set(i, component.variables[k], 1);
             }
+            workspace.setValue(i, component.mines[i]);
+        }
+        workspace.eliminate();
 
-            int matrix[rows][columns];
-            int vector[rows];
-            for (int i = 0; i < rows; ++i) {
-                for (int j = 0; j < columns; ++j) {
-                    matrix[i][j] = 0;
-                }
+        forced.clear();
+        workspace.getForced(forced);
+        std::vector<int> setVariables(columns, -1);
+        for (auto [index, mine]: forced) {
+            setVariables[index] = mine;
+        }
+
+        std::vector<Action> actions;
+        for (int index = 0; index < columns; ++index) {
+            if (setVariables[index] >= 0) {
+                auto [i, j] = component.coordinates[index];
+                actions.emplace_back(Action{i, j, setVariables[index] ? Cell::Flag : Cell::Open});
             }
+        }
+        return actions;
+    }
 
-            for (int i = 0; i < rows; ++i) {
-                for (int index: constraints[i].indices) {
-                    matrix[i][index] = 1;
-                }
-                vector[i] = constraints[i].mines;
+    // the actions a solver finds in every component of a matrix, one after another
+    template<class Solver>
+    std::vector<game::Action> getMatrixActions(const game::ConstraintMatrix &components, Solver solver) {
+        std::vector<Action> actions;
+        for (int c = 0; c < components.size(); ++c) {
+            auto settled = solver(components.getView(c));
+            actions.insert(actions.end(), settled.begin(), settled.end());
+        }
+        return actions;
+    }
+
+    // the same for components given as constraints of their own, flattened one at a time
+    template<class Solver>
+    std::vector<game::Action> getComponentActions(const std::vector<game::Constraint> &components, Solver solver) {
+        std::vector<Action> actions;
+        for (const auto &component: components) {
+            auto settled = solver(ConstraintMatrix(component).getView(0));
+            actions.insert(actions.end(), settled.begin(), settled.end());
+        }
+        return actions;
+    }
+
+    std::vector<game::Action> getExactActionsWeak(const game::ConstraintMatrix &components) {
+        return getMatrixActions(components, [](const ConstraintView &component) {
+            return getExactActionsWeak(component);
+        });
+    }
+
+    std::vector<game::Action> getExactActionsWeak(const std::vector<game::Constraint> &components) {
+        return getComponentActions(components, [](const ConstraintView &component) {
+            return getExactActionsWeak(component);
+        });
+    }
+
+    template<class G>
+    std::vector<game::Action> getExactActionsWeak(const game::State<G> &state) {
+        return getExactActionsWeak(getComponentMatrix(state));
+    }
+
+    std::vector<game::Action> getExactActionsStrong(const game::ConstraintView &component) {
+        std::vector<Action> actions;
+        auto backbone = getComponentCache().getBackbone(component);
+        for (int var = 0; var < backbone.size(); ++var) {
+            if (backbone[var] >= 0) {
+                auto [i, j] = component.coordinates[var];
+                actions.emplace_back(Action{i, j, backbone[var] ? Cell::Flag : Cell::Open});
             }
+        }
+        return actions;
+    }
 
-            makeGaussianElimination(&matrix[0][0], vector, rows, columns);
-            std::unordered_map<int, bool> setVariables;
+    std::vector<game::Action> getExactActionsStrong(const game::ConstraintMatrix &components) {
+        return getMatrixActions(components, [](const ConstraintView &component) {
+            return getExactActionsStrong(component);
+        });
+    }
 
-            for (int i = rows - 1; i >= 0; --i) {
-                int lowerBound = 0;
-                int upperBound = 0;
-                std::vector<int> variables;
+    std::vector<game::Action> getExactActionsStrong(const std::vector<game::Constraint> &components) {
+        return getComponentActions(components, [](const ConstraintView &component) {
+            return getExactActionsStrong(component);
+        });
+    }
 
-                for (int j = 0; j < columns; ++j) {
-                    if (matrix[i][j]) {
-                        variables.push_back(j);
-                    }
-                    lowerBound += std::min(matrix[i][j], 0);
-                    upperBound += std::max(matrix[i][j], 0);
-                }
+    template<class G>
+    std::vector<game::Action> getExactActionsStrong(const game::State<G> &state) {
+        return getExactActionsStrong(getComponentMatrix(state));
+    }
 
-                if (vector[i] == upperBound) {
-                    for (int var: variables) {
-                        setVariables[var] = matrix[i][var] > 0;
-                    }
-                }
-                if (vector[i] == lowerBound) {
-                    for (int var: variables) {
-                        setVariables[var] = matrix[i][var] < 0;
-                    }
+    std::vector<game::Action> getSaturatedActions(const game::ConstraintView &component) {
+        std::vector<int> decided(component.cells, -1);
+        for (int row = 0; row < component.rows; ++row) {
+            int size = component.rowSize(row);
+            int mines = component.mines[row];
+            if (size > 0 && (mines == 0 || mines == size)) {
+                for (int k = component.rowStart[row]; k < component.rowStart[row + 1]; ++k) {
+                    decided[component.variables[k]] = mines > 0;
                 }
             }
+        }
 
-            for (const auto &[index, mine]: setVariables) {
-                auto [i, j] = coordinates[index];
-                actions.emplace_back(Action{i, j, mine ? Cell::Flag : Cell::Open});
+        std::vector<Action> actions;
+        for (int var = 0; var < decided.size(); ++var) {
+            if (decided[var] >= 0) {
+                auto [i, j] = component.coordinates[var];
+                actions.emplace_back(Action{i, j, decided[var] ? Cell::Flag : Cell::Open});
             }
         }
-
         return actions;
     }
 
-    std::vector<game::Action> getExactActionsStrong(const game::State &state) {
-        std::vector<Action> actions;
-        for (const auto& [constraints, coordinates]: decoupleMineConstraints(getMineConstraints(state))) {
-            auto variants = game::getMineVariants(constraints);
+    std::vector<game::Action> getSubsetActions(const game::ConstraintView &component) {
+        // the rows with their variables sorted, laid out like those of the view
+        int offset = component.rowStart[0];
+        std::vector<int> variables(component.variables + offset, component.variables + component.rowStart[component.rows]);
+        for (int row = 0; row < component.rows; ++row) {
+            std::sort(variables.begin() + (component.rowStart[row] - offset),
+                      variables.begin() + (component.rowStart[row + 1] - offset));
+        }
 
-            std::unordered_map<int, bool> constantVariables;
-            for (int i = 0; i < coordinates.size(); ++i) {
-                constantVariables[i] = variants[0].variables[i];
-            }
+        std::vector<int> decided(component.cells, -1);
+        std::vector<int> difference;
+        for (int inner = 0; inner < component.rows; ++inner) {
+            const int *innerFirst = variables.data() + (component.rowStart[inner] - offset);
+            const int *innerLast = variables.data() + (component.rowStart[inner + 1] - offset);
+            for (int outer = 0; outer < component.rows; ++outer) {
+                const int *outerFirst = variables.data() + (component.rowStart[outer] - offset);
+                const int *outerLast = variables.data() + (component.rowStart[outer + 1] - offset);
+                if (inner == outer || component.rowSize(inner) >= component.rowSize(outer) ||
+                    !std::includes(outerFirst, outerLast, innerFirst, innerLast)) {
+                    continue;
+                }
 
-            std::vector<int> changedVariables;
-            changedVariables.reserve(constantVariables.size());
-            for (const auto &variant: variants) {
-                for (const auto &[var, value]: constantVariables) {
-                    if (variant.variables[var] != value) {
-                        changedVariables.push_back(var);
+                difference.clear();
+                std::set_difference(outerFirst, outerLast, innerFirst, innerLast, std::back_inserter(difference));
+                int mines = component.mines[outer] - component.mines[inner];
+                if (mines == 0 || mines == difference.size()) {
+                    for (int var: difference) {
+                        decided[var] = mines > 0;
                     }
                 }
-                for (int var: changedVariables) {
-                    constantVariables.erase(var);
-                }
-                changedVariables.clear();
             }
+        }
 
-            for (const auto &[var, value]: constantVariables) {
-                auto [i, j] = coordinates[var];
-                actions.emplace_back(Action{i, j, value ? Cell::Flag : Cell::Open});
+        std::vector<Action> actions;
+        for (int var = 0; var < decided.size(); ++var) {
+            if (decided[var] >= 0) {
+                auto [i, j] = component.coordinates[var];
+                actions.emplace_back(Action{i, j, decided[var] ? Cell::Flag : Cell::Open});
             }
         }
         return actions;
     }
 
-    std::vector<game::Action> RandomAgent::getActions(const State &state) {
-        auto actions = getPossibleActions(state);
-        if (actions.empty()) {
-            return {};
+    std::vector<game::Action> SolverPipeline::getActions(const game::ConstraintMatrix &components) {
+        tiers_.clear();
+        return getMatrixActions(components, [this](const ConstraintView &component) {
+            return settleComponent(component);
+        });
+    }
+
+    std::vector<game::Action> SolverPipeline::getActions(const std::vector<game::Constraint> &components) {
+        tiers_.clear();
+        return getComponentActions(components, [this](const ConstraintView &component) {
+            return settleComponent(component);
+        });
+    }
+
+    std::vector<game::Action> SolverPipeline::settleComponent(const game::ConstraintView &component) {
+        for (int tier = 0; tier < SolverStats::TIERS; ++tier) {
+            auto start = std::chrono::steady_clock::now();
+            auto settled = runTier(static_cast<SolverTier>(tier), component);
+            stats_.seconds[tier] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            ++stats_.components[tier];
+
+            if (!settled.empty()) {
+                ++stats_.settled[tier];
+                stats_.actions[tier] += static_cast<long long>(settled.size());
+                tiers_.resize(tiers_.size() + settled.size(), static_cast<SolverTier>(tier));
+                return settled;
+            }
+        }
+        return {};
+    }
+
+    template<class G>
+    std::vector<game::Action> SolverPipeline::getActions(const game::State<G> &state) {
+        return getActions(getComponentMatrix(state));
+    }
+
+    std::vector<game::Action> SolverPipeline::runTier(SolverTier tier, const game::ConstraintView &component) {
+        switch (tier) {
+            case SolverTier::Saturation:
+                return getSaturatedActions(component);
+            case SolverTier::Subset:
+                return getSubsetActions(component);
+            case SolverTier::Elimination:
+                return getExactActionsWeak(component);
+            case SolverTier::Enumeration:
+                return getExactActionsStrong(component);
         }
+        return {};
+    }
+
+    template<class G>
+    game::Action RandomAgent<G>::getRandomAction(const State<G> &state) {
+        int size = getPossibleActions(state, actions_.data());
+        return unpackAction(actions_[std::uniform_int_distribution<>(0, size - 1)(gen_)], G::WIDTH);
+    }
 
-        auto action = actions[std::uniform_int_distribution<>(0, static_cast<int>(actions.size()) - 1)(gen_)];
-        return {action};
+    template<class G>
+    std::vector<game::Action> RandomAgent<G>::getActions(const State<G> &state) {
+        if (!state.unknown().any()) {
+            return {};
+        }
+        return {getRandomAction(state)};
     }
 
-    game::GameResult RandomAgent::rollout(PerfectBoard board) {
+    template<class G>
+    game::GameResult RandomAgent<G>::rollout(PerfectBoard<G> board) {
         while (true) {
-            auto actions = getActions(board.getState());
-            for (auto action: actions) {
-                auto result = board.act(action);
-                if (isTerminal(result)) {
-                    return result;
-                }
+            auto result = board.act(getRandomAction(board.getState()));
+            if (isTerminal(result)) {
+                return result;
             }
         }
     }
 
-    void TreeAgent::loadState(game::State state, std::vector<double> policy) {
-        tree_.moveto(state, policy);
+    template<class G>
+    void TreeAgent<G>::loadState(game::State<G> state, std::vector<double> policy) {
+        trees_.moveto(state, policy);
     }
 
-    std::vector<game::Action> TreeAgent::getActions(const game::State& state) {
+    template<class G>
+    std::vector<game::Action> TreeAgent<G>::getActions(const game::State<G> &state) {
         std::vector<Action> actions;
         if (iter_.has_value()) {
-            actions = {tree_.sampleAction()};
+            actions = {trees_.sampleAction()};
             iter_.reset();
         } else {
-            actions = agent::getExactActionsStrong(state);
+            actions = solver_.getActions(state);
             if (actions.empty()) {
                 iter_ = 0;
             }
@@ -139,40 +271,110 @@ namespace agent {
         return actions;
     }
 
-    std::optional<game::State> TreeAgent::explore() {
+    template<class G>
+    std::optional<game::State<G>> TreeAgent<G>::explore() {
         ++iter_.value();
-        auto board = tree_.explore();
-        if (isTerminal(getStateResult(board.getState()))) {
+        auto board = getCurrentTree().explore();
+        if (isTerminal(getStateResult(board))) {
             return std::nullopt;
         }
         return board.getState();
     }
 
-    void TreeAgent::update(std::vector<double> policy, double value) {
-        tree_.updateNode(std::move(policy), value);
+    template<class G>
+    void TreeAgent<G>::update(std::vector<double> policy, double value) {
+        getCurrentTree().updateNode(std::move(policy), value);
     }
 
-    std::vector<game::Action> SimpleTreeAgent::getActions(const State &state) {
-        auto actions = getExactActionsStrong(state);
+    template<class G>
+    std::vector<game::Action> SimpleTreeAgent<G>::getActions(const State<G> &state) {
+        auto actions = solver_.getActions(state);
         if (!actions.empty()) {
             return actions;
         }
 
-        tree_.moveto(state, getSimplePolicy(state));
-        auto agent = RandomAgent(gen_);
+        trees_.moveto(state, getSimplePolicy(state));
+        if (trees_.size() > 1) {
+            searchEnsemble();
+            return {trees_.sampleAction()};
+        }
+
+        auto &tree = trees_[0];
+        if (threads_ > 1) {
+            searchStats_ = tree.search(STEPS, threads_, [](const PerfectBoard<G> &board, std::mt19937 &gen) {
+                return std::make_pair(getSimplePolicy(board.getState()),
+                                      getReward(RandomAgent<G>(gen).rollout(board)));
+            });
+            return {tree.sampleAction()};
+        }
 
+        auto agent = RandomAgent<G>(gen_);
         for (int i = 0; i < STEPS; ++i) {
-            auto board = tree_.explore();
-            if (!isTerminal(getStateResult(board.getState()))) {
-                tree_.updateNode(getSimplePolicy(state), getReward(agent.rollout(board)));
+            auto board = tree.explore();
+            if (!isTerminal(getStateResult(board))) {
+                tree.updateNode(getSimplePolicy(board.getState()), getReward(agent.rollout(board)));
             }
         }
 
-        return {tree_.sampleAction()};
+        return {tree.sampleAction()};
     }
 
-    std::vector<double> SimpleTreeAgent::getSimplePolicy(const State &state) {
-        size_t actionSpace = getPossibleActions(state).size();
+    template<class G>
+    void SimpleTreeAgent<G>::searchEnsemble() {
+        auto start = std::chrono::steady_clock::now();
+        auto worker = [this](int k) {
+            auto &tree = trees_[k];
+            auto agent = RandomAgent<G>(trees_.getGenerator(k));
+            for (int i = 0; i < STEPS; ++i) {
+                auto board = tree.explore();
+                if (!isTerminal(getStateResult(board))) {
+                    tree.updateNode(getSimplePolicy(board.getState()), getReward(agent.rollout(board)));
+                }
+            }
+        };
+
+        pool_->run(trees_.size(), worker);
+
+        auto nVisits = trees_.getRootVisits();
+        searchStats_.threads = trees_.size();
+        searchStats_.iterations = trees_.size() * STEPS;
+        searchStats_.descents = std::accumulate(nVisits.begin(), nVisits.end(), 0);
+        searchStats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    template<class G>
+    std::vector<double> SimpleTreeAgent<G>::getSimplePolicy(const State<G> &state) {
+        size_t actionSpace = state.unknown().count();
         return std::vector<double>(actionSpace, 1.0 / (double) actionSpace);
     }
-}
\ No newline at end of file
+
+    template std::vector<game::Action> SolverPipeline::getActions(const game::State<Beginner> &state);
+    template std::vector<game::Action> SolverPipeline::getActions(const game::State<Intermediate> &state);
+    template std::vector<game::Action> SolverPipeline::getActions(const game::State<Expert> &state);
+    template std::vector<game::Action> SolverPipeline::getActions(const game::State<Custom> &state);
+
+    template std::vector<game::Action> getExactActionsWeak(const game::State<Beginner> &state);
+    template std::vector<game::Action> getExactActionsWeak(const game::State<Intermediate> &state);
+    template std::vector<game::Action> getExactActionsWeak(const game::State<Expert> &state);
+    template std::vector<game::Action> getExactActionsWeak(const game::State<Custom> &state);
+
+    template std::vector<game::Action> getExactActionsStrong(const game::State<Beginner> &state);
+    template std::vector<game::Action> getExactActionsStrong(const game::State<Intermediate> &state);
+    template std::vector<game::Action> getExactActionsStrong(const game::State<Expert> &state);
+    template std::vector<game::Action> getExactActionsStrong(const game::State<Custom> &state);
+
+    template class RandomAgent<Beginner>;
+    template class RandomAgent<Intermediate>;
+    template class RandomAgent<Expert>;
+    template class RandomAgent<Custom>;
+
+    template class TreeAgent<Beginner>;
+    template class TreeAgent<Intermediate>;
+    template class TreeAgent<Expert>;
+    template class TreeAgent<Custom>;
+
+    template class SimpleTreeAgent<Beginner>;
+    template class SimpleTreeAgent<Intermediate>;
+    template class SimpleTreeAgent<Expert>;
+    template class SimpleTreeAgent<Custom>;
+}
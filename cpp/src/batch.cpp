@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "batch.h"
+
+namespace agent {
+    template<class G>
+    void analyzeBatchState(const uint8_t *cells, G geometry, int8_t *actions, float *probability, int32_t *stats) {
+        int height = geometry.height();
+        int width = geometry.width();
+
+        game::State<G> state(geometry);
+        for (int i = 0; i < height; ++i) {
+            for (int j = 0; j < width; ++j) {
+                state.set(i, j, cells[i * width + j]);
+            }
+        }
+
+        std::fill(actions, actions + height * width, 0);
+        game::StateAnalysis<G> analysis;
+        try {
+            analysis = game::analyzeState(state, game::AnalysisMode::Counts);
+        } catch (const std::invalid_argument &) {
+            std::fill(probability, probability + height * width, std::numeric_limits<float>::quiet_NaN());
+            std::fill(stats, stats + static_cast<int>(BatchStat::Count), -1);
+            return;
+        }
+
+        for (const auto &action: getExactActionsStrong(state)) {
+            actions[action.i * width + action.j] = action.cell == game::Cell::Open ? 1 : -1;
+        }
+        for (int i = 0; i < height; ++i) {
+            for (int j = 0; j < width; ++j) {
+                probability[i * width + j] = static_cast<float>(analysis.mineProbability[i * G::WIDTH + j]);
+            }
+        }
+
+        int largest = 0;
+        for (const auto &coordinates: analysis.coordinates) {
+            largest = std::max(largest, static_cast<int>(coordinates.size()));
+        }
+        int frontier = state.frontier().count();
+        stats[static_cast<int>(BatchStat::Components)] = static_cast<int32_t>(analysis.coordinates.size());
+        stats[static_cast<int>(BatchStat::FrontierCells)] = frontier;
+        stats[static_cast<int>(BatchStat::LargestComponent)] = largest;
+        stats[static_cast<int>(BatchStat::InteriorCells)] = state.unknown().count() - frontier;
+    }
+
+    template<class G>
+    void analyzeBatch(const uint8_t *states, int count, G geometry, ThreadPool &pool, int8_t *actions,
+                      float *probability, int32_t *stats) {
+        int cells = geometry.cells();
+        int statCount = static_cast<int>(BatchStat::Count);
+        if (std::any_of(states, states + count * cells, [](uint8_t value) {
+            return value > game::BOMB;
+        })) {
+            throw std::invalid_argument("state cell value out of range");
+        }
+
+        // a few chunks per worker even out the states that take long
+        int chunks = std::min(count, 4 * pool.size());
+        pool.run(chunks, [=](int chunk) {
+            for (int k = chunk * count / chunks; k < (chunk + 1) * count / chunks; ++k) {
+                analyzeBatchState(states + k * cells, geometry, actions + k * cells, probability + k * cells,
+                             stats + k * statCount);
+            }
+        });
+    }
+
+    template void analyzeBatch(const uint8_t *states, int count, game::Beginner geometry, ThreadPool &pool,
+                               int8_t *actions, float *probability, int32_t *stats);
+    template void analyzeBatch(const uint8_t *states, int count, game::Intermediate geometry, ThreadPool &pool,
+                               int8_t *actions, float *probability, int32_t *stats);
+    template void analyzeBatch(const uint8_t *states, int count, game::Expert geometry, ThreadPool &pool,
+                               int8_t *actions, float *probability, int32_t *stats);
+    template void analyzeBatch(const uint8_t *states, int count, game::Custom geometry, ThreadPool &pool,
+                               int8_t *actions, float *probability, int32_t *stats);
+}
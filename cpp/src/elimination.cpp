@@ -0,0 +1,157 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "elimination.h"
+
+namespace agent {
+    template<class T>
+    void clearPrefix(std::vector<T> &vector, size_t size) {
+        if (vector.size() < size) {
+            vector.resize(size);
+        }
+        std::fill(vector.begin(), vector.begin() + static_cast<long>(size), 0);
+    }
+
+    void EliminationWorkspace::reset(int rows, int columns) {
+        rows_ = rows;
+        columns_ = columns;
+        stride_ = (columns + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        rowWords_ = (rows + 63) / 64;
+        columnWords_ = stride_ / 64;
+
+        clearPrefix(coefficients_, static_cast<size_t>(rows) * stride_);
+        clearPrefix(rowMask_, static_cast<size_t>(rows) * columnWords_);
+        clearPrefix(columnMask_, static_cast<size_t>(columns) * rowWords_);
+
+        free_.assign(rowWords_, ~uint64_t(0));
+        if (rows % 64) {
+            free_.back() = (uint64_t(1) << (rows % 64)) - 1;
+        }
+
+        values_.assign(rows, 0);
+        magnitude_.assign(rows, 1);
+        begin_.assign(rows, columns);
+        end_.assign(rows, 0);
+    }
+
+    void EliminationWorkspace::eliminate() {
+        for (int j = 0; j < columns_; ++j) {
+            const uint64_t *column = columnMask_.data() + j * rowWords_;
+
+            int pivot = -1;
+            for (int w = 0; w < rowWords_ && pivot < 0; ++w) {
+                for (uint64_t bits = column[w] & free_[w]; bits; bits &= bits - 1) {
+                    int row = w * 64 + __builtin_ctzll(bits);
+                    int8_t x = coefficient(row, j);
+                    if (x == 1 || x == -1) {
+                        pivot = row;
+                        break;
+                    }
+                }
+            }
+            if (pivot < 0) {
+                continue;
+            }
+            free_[pivot / 64] &= ~(uint64_t(1) << (pivot % 64));
+
+            // an update only clears the bit of the updated row, every word is read once before that
+            for (int w = 0; w < rowWords_; ++w) {
+                for (uint64_t bits = column[w] & free_[w]; bits; bits &= bits - 1) {
+                    int row = w * 64 + __builtin_ctzll(bits);
+                    int8_t x = coefficient(row, j);
+                    if (magnitude_[row] + std::abs(x) * magnitude_[pivot] <= LIMIT) {
+                        subtractRow(row, pivot, x * coefficient(pivot, j));
+                    }
+                }
+            }
+
+            bool empty = true;
+            for (int w = 0; w < rowWords_ && empty; ++w) {
+                for (uint64_t bits = free_[w]; bits && empty; bits &= bits - 1) {
+                    int row = w * 64 + __builtin_ctzll(bits);
+                    empty = begin_[row] >= end_[row];
+                }
+            }
+            if (empty) {
+                break;
+            }
+        }
+    }
+
+    void EliminationWorkspace::getForced(std::vector<std::pair<int, bool>> &forced) const {
+        for (int i = 0; i < rows_; ++i) {
+            const int8_t *row = coefficients_.data() + i * stride_;
+            int lowerBound = 0;
+            int upperBound = 0;
+            for (int j = begin_[i]; j < end_[i]; ++j) {
+                lowerBound += std::min<int>(row[j], 0);
+                upperBound += std::max<int>(row[j], 0);
+            }
+
+            if (begin_[i] >= end_[i] || (values_[i] != upperBound && values_[i] != lowerBound)) {
+                continue;
+            }
+            bool positive = values_[i] == upperBound;
+            for (int j = begin_[i]; j < end_[i]; ++j) {
+                if (row[j]) {
+                    forced.emplace_back(j, (row[j] > 0) == positive);
+                }
+            }
+        }
+    }
+
+    // bit per nonzero byte of a 64 byte block
+    uint64_t getNonzeroMask(const int8_t *block) {
+#ifdef __SSE2__
+        uint64_t zero = 0;
+        for (int b = 0; b < 64; b += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + b));
+            zero |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128()))) << b;
+        }
+        return ~zero;
+#else
+        uint64_t bits = 0;
+        for (int b = 0; b < 64; ++b) {
+            bits |= uint64_t(block[b] != 0) << b;
+        }
+        return bits;
+#endif
+    }
+
+    void EliminationWorkspace::subtractRow(int row, int pivot, int scale) {
+        int8_t *target = coefficients_.data() + row * stride_;
+        const int8_t *source = coefficients_.data() + pivot * stride_;
+        auto factor = static_cast<int8_t>(scale);
+        uint64_t *mask = rowMask_.data() + row * columnWords_;
+
+        // only the blocks holding nonzero coefficients of the pivot row change, their bits are refreshed
+        // and every flipped one is mirrored in the column masks
+        for (int w = begin_[pivot] / 64; w * 64 < end_[pivot]; ++w) {
+            for (int j = w * 64; j < w * 64 + 64; ++j) {
+                target[j] = static_cast<int8_t>(target[j] - factor * source[j]);
+            }
+
+            uint64_t bits = getNonzeroMask(target + w * 64);
+            for (uint64_t flipped = bits ^ mask[w]; flipped; flipped &= flipped - 1) {
+                int column = w * 64 + __builtin_ctzll(flipped);
+                columnMask_[column * rowWords_ + row / 64] ^= uint64_t(1) << (row % 64);
+            }
+            mask[w] = bits;
+        }
+
+        int first = columns_;
+        int last = -1;
+        for (int w = 0; w < columnWords_; ++w) {
+            if (mask[w]) {
+                first = std::min(first, w * 64 + __builtin_ctzll(mask[w]));
+                last = std::max(last, w * 64 + 63 - __builtin_clzll(mask[w]));
+            }
+        }
+
+        values_[row] -= scale * values_[pivot];
+        magnitude_[row] += std::abs(scale) * magnitude_[pivot];
+        begin_[row] = first;
+        end_[row] = last + 1;
+    }
+}
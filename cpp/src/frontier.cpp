@@ -0,0 +1,171 @@
+#include <algorithm>
+
+#include "frontier.h"
+
+namespace game {
+    template<class G>
+    void Frontier<G>::reset(const State<G> &state) {
+        component_.fill(-1);
+        components_.clear();
+        changed_.clear();
+        dirty_ = state.frontier();
+    }
+
+    template<class G>
+    void Frontier<G>::update(const State<G> &state, int i, int j) {
+        int component = component_[getIndex(i, j)];
+        if (component >= 0) {
+            invalidate(component);
+        }
+        dirty_.reset(i, j);
+
+        if (!isOpened(state, i, j)) {
+            return;
+        }
+
+        for (int n = std::max(i - 1, 0); n < std::min(i + 2, state.height()); ++n) {
+            for (int m = std::max(j - 1, 0); m < std::min(j + 2, state.width()); ++m) {
+                if (!isOpened(state, n, m) && !isFlagged(state, n, m)) {
+                    component = component_[getIndex(n, m)];
+                    if (component >= 0) {
+                        invalidate(component);
+                    }
+                    dirty_.set(n, m);
+                }
+            }
+        }
+    }
+
+    template<class G>
+    void Frontier<G>::update(const State<G> &state, const Mask &cells) {
+        auto neighbors = dilate(cells & state.opened()) & state.unknown();
+        (cells | neighbors).forEach([this](int i, int j) {
+            int component = component_[getIndex(i, j)];
+            if (component >= 0) {
+                invalidate(component);
+            }
+        });
+        dirty_ = (dirty_ | neighbors) - cells;
+    }
+
+    template<class G>
+    const std::vector<Constraint> &Frontier<G>::getConstraints(const State<G> &state) {
+        build(state);
+        return components_;
+    }
+
+    template<class G>
+    std::vector<Constraint> Frontier<G>::getChangedConstraints(const State<G> &state) {
+        build(state);
+
+        std::vector<Constraint> constraints;
+        for (int k = 0; k < components_.size(); ++k) {
+            if (changed_[k]) {
+                constraints.push_back(components_[k]);
+                changed_[k] = false;
+            }
+        }
+        return constraints;
+    }
+
+    template<class G>
+    void Frontier<G>::invalidate(int component) {
+        for (auto [i, j]: components_[component].coordinates) {
+            component_[getIndex(i, j)] = -1;
+            dirty_.set(i, j);
+        }
+
+        int last = static_cast<int>(components_.size()) - 1;
+        if (component != last) {
+            components_[component] = std::move(components_[last]);
+            changed_[component] = changed_[last];
+            for (auto [i, j]: components_[component].coordinates) {
+                component_[getIndex(i, j)] = component;
+            }
+        }
+        components_.pop_back();
+        changed_.pop_back();
+    }
+
+    template<class G>
+    void Frontier<G>::build(const State<G> &state) {
+        if (!dirty_.any()) {
+            return;
+        }
+
+        auto dirty = dirty_;
+        dirty.forEach([this, &state](int i, int j) {
+            if (dirty_.test(i, j)) {
+                buildComponent(state, i, j);
+            }
+        });
+    }
+
+    template<class G>
+    void Frontier<G>::buildComponent(const State<G> &state, int i, int j) {
+        dirty_.reset(i, j);
+        if (isOpened(state, i, j) || isFlagged(state, i, j) || !isNeighbor(state, i, j)) {
+            return;
+        }
+
+        int component = static_cast<int>(components_.size());
+        std::vector<std::pair<int, int>> coordinates;
+        std::vector<std::pair<int, int>> rows;
+        Mask visitedRows;
+
+        component_[getIndex(i, j)] = component;
+        std::vector<std::pair<int, int>> cells = {{i, j}};
+
+        while (!cells.empty()) {
+            auto [vi, vj] = cells.back();
+            cells.pop_back();
+            coordinates.emplace_back(vi, vj);
+
+            for (int n = std::max(vi - 1, 0); n < std::min(vi + 2, state.height()); ++n) {
+                for (int m = std::max(vj - 1, 0); m < std::min(vj + 2, state.width()); ++m) {
+                    if (!isOpened(state, n, m) || visitedRows.test(n, m)) {
+                        continue;
+                    }
+                    visitedRows.set(n, m);
+                    rows.emplace_back(n, m);
+
+                    for (int r = std::max(n - 1, 0); r < std::min(n + 2, state.height()); ++r) {
+                        for (int c = std::max(m - 1, 0); c < std::min(m + 2, state.width()); ++c) {
+                            if (!isOpened(state, r, c) && !isFlagged(state, r, c) &&
+                                component_[getIndex(r, c)] != component) {
+                                component_[getIndex(r, c)] = component;
+                                dirty_.reset(r, c);
+                                cells.emplace_back(r, c);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        std::sort(coordinates.begin(), coordinates.end());
+        std::sort(rows.begin(), rows.end());
+
+        for (int k = 0; k < coordinates.size(); ++k) {
+            auto [vi, vj] = coordinates[k];
+            index_[getIndex(vi, vj)] = k;
+        }
+
+        // rows are built the way getConstraintMatrix builds them, only over the cells of this component
+        ConstraintMatrix matrix;
+        auto unknown = state.unknown();
+        for (auto [n, m]: rows) {
+            addConstraintRow(matrix, state, unknown, index_, n, m);
+        }
+        matrix.coordinates = std::move(coordinates);
+        matrix.components.push_back({0, matrix.rows(), 0, static_cast<int>(matrix.coordinates.size())});
+
+        components_.emplace_back(matrix.getConstraint(0));
+        changed_.push_back(true);
+    }
+
+    template class Frontier<Beginner>;
+    template class Frontier<Intermediate>;
+    template class Frontier<Expert>;
+    template class Frontier<Custom>;
+}
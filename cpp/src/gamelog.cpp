@@ -0,0 +1,206 @@
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "gamelog.h"
+
+namespace agent {
+    int alignRecord(int size) {
+        return (size + 3) & ~3;
+    }
+
+    int getMaskBytes(int height, int width) {
+        return alignRecord((height * width + 7) / 8);
+    }
+
+    void putShort(uint8_t *ptr, uint16_t value) {
+        ptr[0] = value & 0xff;
+        ptr[1] = value >> 8;
+    }
+
+    uint16_t getShort(const uint8_t *ptr) {
+        return static_cast<uint16_t>(ptr[0] | ptr[1] << 8);
+    }
+
+    template<class G>
+    GameWriter<G>::GameWriter(std::string prefix, int gamesPerShard)
+            : prefix_(std::move(prefix)), gamesPerShard_(std::max(gamesPerShard, 1)) {
+        while (std::ifstream(getShardName(prefix_, shard_))) {
+            ++shard_;
+        }
+        openShard();
+    }
+
+    template<class G>
+    void GameWriter<G>::openShard() {
+        file_ = std::ofstream(getShardName(prefix_, shard_++), std::ios::binary);
+        if (!file_) {
+            throw std::runtime_error("cannot open game shard");
+        }
+    }
+
+    template<class G>
+    std::string GameWriter<G>::getShardName(const std::string &prefix, int shard) {
+        std::ostringstream name;
+        name << prefix << '-' << std::setw(5) << std::setfill('0') << shard << ".bin";
+        return name.str();
+    }
+
+    template<class G>
+    void GameWriter<G>::write(const GameLog<G> &log) {
+        if (games_ > 0 && games_ % gamesPerShard_ == 0) {
+            openShard();
+        }
+
+        auto record = encodeGame(log);
+        file_.write(reinterpret_cast<const char *>(record.data()), static_cast<std::streamsize>(record.size()));
+        file_.flush();
+        if (!file_) {
+            throw std::runtime_error("cannot write game shard");
+        }
+        ++games_;
+    }
+
+    template<class G>
+    std::vector<uint8_t> encodeGame(const GameLog<G> &log) {
+        int height = log.geometry.height();
+        int width = log.geometry.width();
+        int actions = static_cast<int>(log.actions.size());
+        int visits = static_cast<int>(log.visits.size());
+
+        int maskBytes = getMaskBytes(height, width);
+        int actionBytes = alignRecord(2 * actions);
+        int size = static_cast<int>(sizeof(GameHeader)) + maskBytes + 2 * actionBytes + 4 * visits;
+        std::vector<uint8_t> record(size);
+
+        // the fields of the header are little endian on every target this builds for
+        GameHeader header{GameHeader::MAGIC, static_cast<uint32_t>(size), static_cast<uint16_t>(height),
+                          static_cast<uint16_t>(width), static_cast<uint16_t>(log.mines.count()),
+                          static_cast<uint16_t>(actions), static_cast<uint32_t>(visits),
+                          static_cast<float>(log.result), {0, 0}};
+        std::memcpy(record.data(), &header, sizeof(GameHeader));
+
+        uint8_t *mines = record.data() + sizeof(GameHeader);
+        log.mines.forEach([mines, width](int i, int j) {
+            int index = i * width + j;
+            mines[index >> 3] |= 1 << (index & 7);
+        });
+
+        uint8_t *deltas = mines + maskBytes;
+        uint8_t *searches = deltas + actionBytes;
+        uint16_t previous = 0;
+        for (int n = 0; n < actions; ++n) {
+            uint16_t id = game::packAction(log.actions[n], width);
+            putShort(deltas + 2 * n, static_cast<uint16_t>(id - previous));
+            putShort(searches + 2 * n, static_cast<uint16_t>(log.searches[n]));
+            previous = id;
+        }
+
+        uint8_t *entries = searches + actionBytes;
+        for (int n = 0; n < visits; ++n) {
+            const auto &[action, count] = log.visits[n];
+            putShort(entries + 4 * n, game::packAction(action, width));
+            putShort(entries + 4 * n + 2, static_cast<uint16_t>(std::min(count, 0xffff)));
+        }
+
+        return record;
+    }
+
+    template<class G>
+    std::vector<GameLog<G>> readGames(const std::string &path, G geometry) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("cannot open game shard");
+        }
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        std::vector<GameLog<G>> games;
+        size_t offset = 0;
+        while (offset < data.size()) {
+            GameHeader header;
+            if (data.size() - offset < sizeof(GameHeader)) {
+                throw std::runtime_error("truncated game record");
+            }
+            std::memcpy(&header, data.data() + offset, sizeof(GameHeader));
+            if (header.magic != GameHeader::MAGIC || header.size > data.size() - offset) {
+                throw std::runtime_error("damaged game record");
+            }
+            if (header.height != geometry.height() || header.width != geometry.width() ||
+                header.mines != geometry.mines()) {
+                throw std::runtime_error("game record of another geometry");
+            }
+
+            int width = header.width;
+            int maskBytes = getMaskBytes(header.height, width);
+            int actionBytes = alignRecord(2 * header.actions);
+            if (header.size != sizeof(GameHeader) + maskBytes + 2 * actionBytes + 4 * static_cast<size_t>(header.visits)) {
+                throw std::runtime_error("damaged game record");
+            }
+            const uint8_t *mines = data.data() + offset + sizeof(GameHeader);
+            const uint8_t *deltas = mines + maskBytes;
+            const uint8_t *searches = deltas + actionBytes;
+            const uint8_t *entries = searches + actionBytes;
+
+            GameLog<G> log;
+            log.geometry = geometry;
+            log.result = header.result;
+            for (int index = 0; index < header.height * width; ++index) {
+                if (mines[index >> 3] >> (index & 7) & 1) {
+                    log.mines.set(index / width, index % width);
+                }
+            }
+
+            uint16_t id = 0;
+            for (int n = 0; n < header.actions; ++n) {
+                id += getShort(deltas + 2 * n);
+                log.actions.push_back(game::unpackAction(id, width));
+                log.searches.push_back(getShort(searches + 2 * n));
+            }
+            for (int n = 0; n < header.visits; ++n) {
+                log.visits.emplace_back(game::unpackAction(getShort(entries + 4 * n), width),
+                                        getShort(entries + 4 * n + 2));
+            }
+
+            games.push_back(std::move(log));
+            offset += header.size;
+        }
+
+        return games;
+    }
+
+    template<class G>
+    std::vector<game::State<G>> replayGame(const GameLog<G> &log) {
+        // a board on a given layout never draws from its generator
+        std::mt19937 gen;
+        game::Board<G> board(gen, log.geometry, log.mines);
+
+        std::vector<game::State<G>> states;
+        states.reserve(log.actions.size());
+        for (const auto &action: log.actions) {
+            states.push_back(board.getState());
+            board.act(action);
+        }
+        return states;
+    }
+
+    template class GameWriter<game::Beginner>;
+    template class GameWriter<game::Intermediate>;
+    template class GameWriter<game::Expert>;
+    template class GameWriter<game::Custom>;
+
+    template std::vector<uint8_t> encodeGame(const GameLog<game::Beginner> &log);
+    template std::vector<uint8_t> encodeGame(const GameLog<game::Intermediate> &log);
+    template std::vector<uint8_t> encodeGame(const GameLog<game::Expert> &log);
+    template std::vector<uint8_t> encodeGame(const GameLog<game::Custom> &log);
+
+    template std::vector<GameLog<game::Beginner>> readGames(const std::string &path, game::Beginner geometry);
+    template std::vector<GameLog<game::Intermediate>> readGames(const std::string &path, game::Intermediate geometry);
+    template std::vector<GameLog<game::Expert>> readGames(const std::string &path, game::Expert geometry);
+    template std::vector<GameLog<game::Custom>> readGames(const std::string &path, game::Custom geometry);
+
+    template std::vector<game::State<game::Beginner>> replayGame(const GameLog<game::Beginner> &log);
+    template std::vector<game::State<game::Intermediate>> replayGame(const GameLog<game::Intermediate> &log);
+    template std::vector<game::State<game::Expert>> replayGame(const GameLog<game::Expert> &log);
+    template std::vector<game::State<game::Custom>> replayGame(const GameLog<game::Custom> &log);
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <array>
+
+#include "layout.h"
+
+namespace game {
+    template<class G>
+    typename State<G>::Mask LayoutGenerator<G>::generate(std::mt19937 &gen) const {
+        int width = geometry_.width();
+        typename State<G>::Mask mines;
+        sampleCells(geometry_.cells(), geometry_.mines(), gen, mines, [width](int index) {
+            return std::make_pair(index / width, index % width);
+        });
+        return mines;
+    }
+
+    template<class G>
+    typename State<G>::Mask LayoutGenerator<G>::generate(std::mt19937 &gen, int i, int j) const {
+        int height = geometry_.height();
+        int width = geometry_.width();
+
+        int top = std::max(i - 1, 0), bottom = std::min(i + 1, height - 1);
+        int left = std::max(j - 1, 0), right = std::min(j + 1, width - 1);
+        if (firstClick_ == FirstClick::Cell ||
+            geometry_.cells() - (bottom - top + 1) * (right - left + 1) < geometry_.mines()) {
+            top = bottom = i;
+            left = right = j;
+        }
+
+        // row major indices of the excluded cells in increasing order, the n-th free cell is n moved past
+        // every excluded cell at or before it
+        std::array<int, 9> excluded;
+        int size = 0;
+        for (int n = top; n <= bottom; ++n) {
+            for (int m = left; m <= right; ++m) {
+                excluded[size++] = n * width + m;
+            }
+        }
+
+        typename State<G>::Mask mines;
+        sampleCells(geometry_.cells() - size, geometry_.mines(), gen, mines, [&excluded, size, width](int index) {
+            for (int k = 0; k < size && excluded[k] <= index; ++k) {
+                ++index;
+            }
+            return std::make_pair(index / width, index % width);
+        });
+        return mines;
+    }
+
+    template class LayoutGenerator<Beginner>;
+    template class LayoutGenerator<Intermediate>;
+    template class LayoutGenerator<Expert>;
+    template class LayoutGenerator<Custom>;
+}
@@ -2,382 +2,1215 @@
 #include <algorithm>
 #include <numeric>
 #include <optional>
-#include <unordered_set>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
 
+#include "layout.h"
 #include "mines.h"
 
-template<>
-struct std::hash<std::pair<int, int>> {
-    size_t operator()(const std::pair<int, int> &x) const noexcept {
-        return std::hash<int64_t>()(static_cast<int64_t>(x.first) << 32 | x.second);
+namespace game {
+    ConstraintMatrix::ConstraintMatrix(const std::vector<Group> &groups) {
+        rowStart.reserve(groups.size() + 1);
+        mines.reserve(groups.size());
+        int cells = 0;
+        for (const auto &group: groups) {
+            for (int var: group.indices) {
+                cells = std::max(cells, var + 1);
+            }
+            variables.insert(variables.end(), group.indices.begin(), group.indices.end());
+            rowStart.push_back(static_cast<int>(variables.size()));
+            mines.push_back(group.mines);
+        }
+        components.push_back({0, rows(), 0, cells});
     }
-};
 
-namespace game {
-    static const std::vector<std::pair<int, int>> offset = {{-1, -1},
-                                                            {-1, 0},
-                                                            {-1, 1},
-                                                            {0,  -1},
-                                                            {0,  1},
-                                                            {1,  -1},
-                                                            {1,  0},
-                                                            {1,  1}};
-
-    Constraint getMineConstraints(const State &state) {
-        std::vector<Group> groups(HEIGHT * WIDTH);
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                if (state[i][j] > EMPTY) {
-                    groups[i * WIDTH + j].mines = state[i][j] - EMPTY;
-                }
-            }
-        }
-
-        std::unordered_map<std::pair<int, int>, int> indices;
-
-        for (auto [dRow, dColumn]: offset) {
-            int startRow = std::max(-dRow, 0);
-            int endRow = std::min(HEIGHT - dRow, HEIGHT);
-            int startColumn = std::max(-dColumn, 0);
-            int endColumn = std::min(WIDTH - dColumn, WIDTH);
-
-            for (int i = startRow; i < endRow; ++i) {
-                for (int j = startColumn; j < endColumn; ++j) {
-                    if (state[i][j] >= EMPTY) {
-                        if (state[i + dRow][j + dColumn] == FLAG) {
-                            --groups[i * WIDTH + j].mines;
-                        } else if (!state[i + dRow][j + dColumn]) {
-                            auto pair = std::make_pair(i + dRow, j + dColumn);
-                            if (indices.count(pair)) {
-                                groups[i * WIDTH + j].indices.push_back(indices[pair]);
-                            } else {
-                                int index = static_cast<int>(indices.size());
-                                groups[i * WIDTH + j].indices.push_back(index);
-                                indices[pair] = index;
-                            }
-                        }
-                    }
-                }
+    ConstraintMatrix::ConstraintMatrix(const Constraint &constraint) : ConstraintMatrix(constraint.groups) {
+        coordinates = constraint.coordinates;
+        components[0].cellEnd = static_cast<int>(coordinates.size());
+    }
+
+    ConstraintView ConstraintMatrix::getView(int component) const {
+        const auto &[rowBegin, rowEnd, cellBegin, cellEnd] = components[component];
+        return {rowStart.data() + rowBegin, variables.data(), mines.data() + rowBegin,
+                coordinates.empty() ? nullptr : coordinates.data() + cellBegin, rowEnd - rowBegin, cellEnd - cellBegin};
+    }
+
+    Constraint ConstraintMatrix::getConstraint(int component) const {
+        const auto &[rowBegin, rowEnd, cellBegin, cellEnd] = components[component];
+        Constraint constraint;
+        constraint.coordinates.assign(coordinates.begin() + cellBegin, coordinates.begin() + cellEnd);
+        constraint.groups.resize(rowEnd - rowBegin);
+        for (int r = rowBegin; r < rowEnd; ++r) {
+            auto &group = constraint.groups[r - rowBegin];
+            group.indices.assign(variables.begin() + rowStart[r], variables.begin() + rowStart[r + 1]);
+            group.mines = mines[r];
+        }
+        return constraint;
+    }
+
+    template<class G>
+    ConstraintMatrix getConstraintMatrix(const State<G> &state) {
+        auto frontier = state.frontier();
+        auto opened = state.opened() & dilate(frontier);
+
+        ConstraintMatrix matrix;
+        std::array<int, G::HEIGHT * G::WIDTH> index;
+        matrix.coordinates.reserve(frontier.count());
+        frontier.forEach([&](int i, int j) {
+            index[i * G::WIDTH + j] = static_cast<int>(matrix.coordinates.size());
+            matrix.coordinates.emplace_back(i, j);
+        });
+
+        int rows = opened.count();
+        matrix.rowStart.reserve(rows + 1);
+        matrix.variables.reserve(8 * rows);
+        matrix.mines.reserve(rows);
+        opened.forEach([&](int i, int j) {
+            addConstraintRow(matrix, state, frontier, index, i, j);
+        });
+
+        matrix.components.push_back({0, rows, 0, static_cast<int>(matrix.coordinates.size())});
+        return matrix;
+    }
+
+    template<class G>
+    ConstraintMatrix getComponentMatrix(const State<G> &state) {
+        auto matrix = getConstraintMatrix(state);
+        splitComponents(matrix);
+        return matrix;
+    }
+
+    int findRoot(std::vector<int> &parent, int v) {
+        while (parent[v] != v) {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    }
+
+    void splitComponents(ConstraintMatrix &matrix) {
+        int cells = static_cast<int>(matrix.coordinates.size());
+        int rows = matrix.rows();
+
+        // the cells of a row are joined one after another, the smallest cell of every set is its root
+        std::vector<int> parent(cells);
+        std::iota(parent.begin(), parent.end(), 0);
+        for (int r = 0; r < rows; ++r) {
+            for (int k = matrix.rowStart[r] + 1; k < matrix.rowStart[r + 1]; ++k) {
+                int lhs = findRoot(parent, matrix.variables[k - 1]);
+                int rhs = findRoot(parent, matrix.variables[k]);
+                parent[std::max(lhs, rhs)] = std::min(lhs, rhs);
             }
         }
 
-        std::vector<Group> filteredGroups;
-        for (const auto &group: groups) {
-            if (!group.indices.empty()) {
-                filteredGroups.push_back(group);
+        std::vector<int> rowComponent(rows, -1);
+        std::vector<bool> reached(cells);
+        for (int r = 0; r < rows; ++r) {
+            if (matrix.rowStart[r] < matrix.rowStart[r + 1]) {
+                rowComponent[r] = findRoot(parent, matrix.variables[matrix.rowStart[r]]);
+                reached[rowComponent[r]] = true;
+            }
+        }
+
+        std::vector<int> component(cells, -1);
+        std::vector<ConstraintMatrix::Component> components;
+        for (int v = 0; v < cells; ++v) {
+            if (parent[v] == v && reached[v]) {
+                component[v] = static_cast<int>(components.size());
+                components.push_back({0, 0, 0, 0});
+            }
+        }
+        for (int v = 0; v < cells; ++v) {
+            component[v] = component[findRoot(parent, v)];
+            if (component[v] >= 0) {
+                ++components[component[v]].cellEnd;
+            }
+        }
+        for (int r = 0; r < rows; ++r) {
+            if (rowComponent[r] >= 0) {
+                rowComponent[r] = component[rowComponent[r]];
+                ++components[rowComponent[r]].rowEnd;
+            }
+        }
+
+        // sizes into ranges, the ends move back to where they belong while the rows and cells are placed
+        int rowOffset = 0, cellOffset = 0;
+        for (auto &[rowBegin, rowEnd, cellBegin, cellEnd]: components) {
+            rowBegin = rowOffset;
+            rowOffset += rowEnd;
+            rowEnd = rowBegin;
+            cellBegin = cellOffset;
+            cellOffset += cellEnd;
+            cellEnd = cellBegin;
+        }
+
+        std::vector<int> local(cells);
+        std::vector<std::pair<int, int>> coordinates(cellOffset);
+        for (int v = 0; v < cells; ++v) {
+            if (component[v] >= 0) {
+                auto &range = components[component[v]];
+                local[v] = range.cellEnd - range.cellBegin;
+                coordinates[range.cellEnd++] = matrix.coordinates[v];
+            }
+        }
+
+        std::vector<int> order(rowOffset);
+        for (int r = 0; r < rows; ++r) {
+            if (rowComponent[r] >= 0) {
+                order[components[rowComponent[r]].rowEnd++] = r;
             }
         }
 
-        std::vector<std::pair<int, int>> coordinates(indices.size());
-        for (const auto &[pair, index]: indices) {
-            coordinates[index] = pair;
+        std::vector<int> rowStart(rowOffset + 1);
+        std::vector<int> variables;
+        std::vector<int> mines(rowOffset);
+        variables.reserve(matrix.variables.size());
+        for (int n = 0; n < rowOffset; ++n) {
+            int r = order[n];
+            for (int k = matrix.rowStart[r]; k < matrix.rowStart[r + 1]; ++k) {
+                variables.push_back(local[matrix.variables[k]]);
+            }
+            rowStart[n + 1] = static_cast<int>(variables.size());
+            mines[n] = matrix.mines[r];
         }
 
-        return {filteredGroups, coordinates};
+        matrix.rowStart = std::move(rowStart);
+        matrix.variables = std::move(variables);
+        matrix.mines = std::move(mines);
+        matrix.coordinates = std::move(coordinates);
+        matrix.components = std::move(components);
+    }
+
+    template<class G>
+    Constraint getMineConstraints(const State<G> &state) {
+        return getConstraintMatrix(state).getConstraint(0);
+    }
+
+    std::vector<Constraint> decoupleMineConstraints(ConstraintMatrix matrix) {
+        splitComponents(matrix);
+        std::vector<Constraint> constraints;
+        constraints.reserve(matrix.components.size());
+        for (int c = 0; c < matrix.components.size(); ++c) {
+            constraints.emplace_back(matrix.getConstraint(c));
+        }
+        return constraints;
     }
 
     std::vector<Constraint> decoupleMineConstraints(const Constraint &constraint) {
-        std::vector<std::vector<int>> edges(constraint.coordinates.size());
-        std::vector<std::vector<int>> vertexToGroup(constraint.coordinates.size());
+        return decoupleMineConstraints(ConstraintMatrix(constraint));
+    }
 
-        for (int i = 0; i < constraint.groups.size(); ++i) {
-            const auto &indices = constraint.groups[i].indices;
-            for (int j = 1; j < indices.size(); ++j) {
-                edges[indices[j]].push_back(indices[j - 1]);
-                edges[indices[j - 1]].push_back(indices[j]);
+    // Constraints flattened into rows of at most 64 cells each, a bit per cell that is still free,
+    // together with the rows every cell takes part in. Assignments live on a trail and are undone
+    // in place, unit propagation settles whatever an assignment forces.
+    class ConstraintPropagator {
+    protected:
+        explicit ConstraintPropagator(const ConstraintView &constraints) {
+            int variables = constraints.cells;
+            rowStart_.reserve(constraints.rows + 1);
+            rowStart_.push_back(0);
+            rowVariables_.reserve(constraints.rowStart[constraints.rows] - constraints.rowStart[0]);
+            for (int row = 0; row < constraints.rows; ++row) {
+                int size = constraints.rowSize(row);
+                if (size >= 64) {
+                    throw std::invalid_argument("constraint has too many cells");
+                }
+                const int *first = constraints.variables + constraints.rowStart[row];
+                rowVariables_.insert(rowVariables_.end(), first, first + size);
+                rowStart_.push_back(static_cast<int>(rowVariables_.size()));
+                rowFree_.push_back(size == 0 ? 0 : ~uint64_t(0) >> (64 - size));
+                rowMines_.push_back(constraints.mines[row]);
+            }
+
+            std::vector<int> degree(variables);
+            for (int var: rowVariables_) {
+                ++degree[var];
             }
-            for (int vertex: indices) {
-                vertexToGroup[vertex].push_back(i);
+            variableStart_.resize(variables + 1);
+            for (int var = 0; var < variables; ++var) {
+                variableStart_[var + 1] = variableStart_[var] + degree[var];
             }
+            variableRows_.resize(rowVariables_.size());
+            variableSlots_.resize(rowVariables_.size());
+
+            std::vector<int> filled(variableStart_.begin(), variableStart_.end() - 1);
+            for (int row = 0; row + 1 < rowStart_.size(); ++row) {
+                for (int slot = 0; slot < rowStart_[row + 1] - rowStart_[row]; ++slot) {
+                    int var = rowVariables_[rowStart_[row] + slot];
+                    variableRows_[filled[var]] = row;
+                    variableSlots_[filled[var]++] = slot;
+                }
+            }
+
+            order_.resize(variables);
+            std::iota(order_.begin(), order_.end(), 0);
+            std::stable_sort(order_.begin(), order_.end(), [&degree](int lhs, int rhs) {
+                return degree[lhs] > degree[rhs];
+            });
+
+            values_.assign(variables, -1);
+            trail_.reserve(variables);
+            variableStamp_.assign(variables, 0);
+            rowStamp_.assign(rowMines_.size(), 0);
         }
 
-        std::unordered_set<int> visited;
-        std::vector<Constraint> constraints;
+        // settles every row against the untouched constraints, to be followed by propagate
+        bool settleAll() {
+            for (int row = 0; row + 1 < rowStart_.size(); ++row) {
+                if (!settleRow(row)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool assign(int var, int8_t value) {
+            if (values_[var] >= 0) {
+                return values_[var] == value;
+            }
+            values_[var] = value;
+            trail_.push_back(var);
+            return true;
+        }
 
-        for (int i = 0; i < constraint.coordinates.size(); ++i) {
-            std::unordered_set<int> visitedGroups;
-            std::unordered_map<int, int> visitedVertices;
-            std::vector<int> vertices = {i};
-
-            while (!vertices.empty()) {
-                int vertex = vertices.back();
-                vertices.pop_back();
-                if (!visited.count(vertex)) {
-                    visited.insert(vertex);
-                    visitedVertices[vertex] = static_cast<int>(visitedVertices.size());
-                    for (int neighbor: edges[vertex]) {
-                        vertices.push_back(neighbor);
+        // checks a row against its remaining free cells and forces them when it is saturated
+        bool settleRow(int row) {
+            int free = __builtin_popcountll(rowFree_[row]);
+            int mines = rowMines_[row];
+
+            if (mines < 0 || mines > free) {
+                return false;
+            }
+            if (free > 0 && (mines == 0 || mines == free)) {
+                for (uint64_t bits = rowFree_[row]; bits; bits &= bits - 1) {
+                    if (!assign(rowVariables_[rowStart_[row] + __builtin_ctzll(bits)], mines > 0)) {
+                        return false;
                     }
                 }
             }
+            return true;
+        }
 
-            for (auto [vertex, _]: visitedVertices) {
-                for (int group: vertexToGroup[vertex]) {
-                    visitedGroups.insert(group);
+        bool propagate() {
+            while (head_ < trail_.size()) {
+                int var = trail_[head_++];
+                for (int k = variableStart_[var]; k < variableStart_[var + 1]; ++k) {
+                    int row = variableRows_[k];
+                    rowFree_[row] &= ~(uint64_t(1) << variableSlots_[k]);
+                    rowMines_[row] -= values_[var];
+                }
+                for (int k = variableStart_[var]; k < variableStart_[var + 1]; ++k) {
+                    if (!settleRow(variableRows_[k])) {
+                        return false;
+                    }
                 }
             }
+            return true;
+        }
 
-            Constraint c;
-            c.coordinates.resize(visitedVertices.size());
+        void undo(size_t size) {
+            while (trail_.size() > size) {
+                int var = trail_.back();
+                trail_.pop_back();
 
-            for (auto [vertex, vertexIndex]: visitedVertices) {
-                c.coordinates[vertexIndex] = constraint.coordinates[vertex];
+                if (trail_.size() < head_) {
+                    for (int k = variableStart_[var]; k < variableStart_[var + 1]; ++k) {
+                        int row = variableRows_[k];
+                        rowFree_[row] |= uint64_t(1) << variableSlots_[k];
+                        rowMines_[row] += values_[var];
+                    }
+                }
+                values_[var] = -1;
             }
-            for (int group: visitedGroups) {
-                Group g;
-                g.mines = constraint.groups[group].mines;
-                for (int vertex: constraint.groups[group].indices) {
-                    g.indices.push_back(visitedVertices[vertex]);
+            head_ = std::min(head_, size);
+        }
+
+        // free variables grouped by the constraints that still connect them, every group sorted
+        std::vector<std::vector<int>> split(const std::vector<int> &variables) {
+            ++stamp_;
+            std::vector<std::vector<int>> components;
+
+            for (int first: variables) {
+                if (values_[first] >= 0 || variableStamp_[first] == stamp_) {
+                    continue;
+                }
+                variableStamp_[first] = stamp_;
+                std::vector<int> component = {first};
+
+                for (int n = 0; n < component.size(); ++n) {
+                    int var = component[n];
+                    for (int k = variableStart_[var]; k < variableStart_[var + 1]; ++k) {
+                        int row = variableRows_[k];
+                        for (uint64_t bits = rowFree_[row]; bits; bits &= bits - 1) {
+                            int other = rowVariables_[rowStart_[row] + __builtin_ctzll(bits)];
+                            if (variableStamp_[other] != stamp_) {
+                                variableStamp_[other] = stamp_;
+                                component.push_back(other);
+                            }
+                        }
+                    }
+                }
+
+                std::sort(component.begin(), component.end());
+                components.emplace_back(std::move(component));
+            }
+            return components;
+        }
+
+        // the cells of a component followed by the constraints over them with their mines left
+        std::vector<int> getKey(const std::vector<int> &component) {
+            ++stamp_;
+            std::vector<int> rows;
+            for (int var: component) {
+                for (int k = variableStart_[var]; k < variableStart_[var + 1]; ++k) {
+                    int row = variableRows_[k];
+                    if (rowStamp_[row] != stamp_) {
+                        rowStamp_[row] = stamp_;
+                        rows.push_back(row);
+                    }
                 }
-                c.groups.emplace_back(std::move(g));
             }
+            std::sort(rows.begin(), rows.end());
 
-            if (!c.groups.empty()) {
-                constraints.emplace_back(std::move(c));
+            std::vector<int> key(component);
+            key.push_back(-1);
+            for (int row: rows) {
+                key.push_back(row);
+                key.push_back(rowMines_[row]);
             }
+            return key;
         }
 
-        return constraints;
-    }
+    protected:
+        std::vector<int> rowStart_;
+        std::vector<int> rowVariables_;
+        std::vector<uint64_t> rowFree_;
+        std::vector<int> rowMines_;
 
-    std::vector<Group> reduceConstraints(const std::vector<Group> &constraints,
-                                         const std::unordered_map<int, bool> &setVariables) {
-        std::vector<Group> groups;
-        for (const auto &group: constraints) {
-            std::vector<int> indices;
-            int mines = group.mines;
+        std::vector<int> variableStart_;
+        std::vector<int> variableRows_;
+        std::vector<int> variableSlots_;
 
-            for (int i: group.indices) {
-                if (setVariables.count(i)) {
-                    mines -= setVariables.at(i);
-                } else {
-                    indices.push_back(i);
+        std::vector<int> order_;
+        std::vector<int8_t> values_;
+        std::vector<int> trail_;
+        size_t head_ = 0;
+
+        std::vector<int> variableStamp_;
+        std::vector<int> rowStamp_;
+        int stamp_ = 0;
+    };
+
+    // Backtracking over whole constraints: a branch assigns every free cell of one constraint at once,
+    // walking the k-of-n combinations directly, so the search itself never allocates.
+    class VariantEnumerator : ConstraintPropagator {
+    public:
+        explicit VariantEnumerator(const ConstraintView &constraints) : ConstraintPropagator(constraints) {}
+
+        void enumerate(std::vector<Variant> &variants) {
+            if (settleAll() && propagate()) {
+                search(0, variants);
+            }
+        }
+
+    private:
+        void search(int next, std::vector<Variant> &variants) {
+            while (next < order_.size() && values_[order_[next]] >= 0) {
+                ++next;
+            }
+            if (next == order_.size()) {
+                std::vector<bool> variant(values_.size());
+                for (int var = 0; var < values_.size(); ++var) {
+                    variant[var] = values_[var];
                 }
+                variants.emplace_back(Variant{std::move(variant)});
+                return;
             }
 
-            groups.push_back(Group{indices, mines});
+            int var = order_[next];
+            int best = -1;
+            for (int k = variableStart_[var]; k < variableStart_[var + 1]; ++k) {
+                int row = variableRows_[k];
+                if (best < 0 || __builtin_popcountll(rowFree_[row]) < __builtin_popcountll(rowFree_[best])) {
+                    best = row;
+                }
+            }
+
+            size_t mark = trail_.size();
+            if (best < 0) {
+                for (int8_t value = 0; value < 2; ++value) {
+                    assign(var, value);
+                    if (propagate()) {
+                        search(next, variants);
+                    }
+                    undo(mark);
+                }
+                return;
+            }
+
+            int slots[64];
+            int free = 0;
+            for (uint64_t bits = rowFree_[best]; bits; bits &= bits - 1) {
+                slots[free++] = rowVariables_[rowStart_[best] + __builtin_ctzll(bits)];
+            }
+            int mines = rowMines_[best];
+
+            // Gosper's hack over the free cells of the row: every free-choose-mines subset exactly once
+            uint64_t combination = (uint64_t(1) << mines) - 1;
+            while (!(combination >> free)) {
+                bool consistent = true;
+                for (int k = 0; k < free && consistent; ++k) {
+                    consistent = assign(slots[k], (combination >> k) & 1);
+                }
+                if (consistent && propagate()) {
+                    search(next, variants);
+                }
+                undo(mark);
+
+                if (!combination) {
+                    break;
+                }
+                uint64_t lowest = combination & -combination;
+                uint64_t ripple = combination + lowest;
+                combination = (((ripple ^ combination) >> 2) / lowest) | ripple;
+            }
         }
+    };
 
-        std::sort(groups.begin(), groups.end(), [](const Group &lhs, const Group &rhs) {
-            return lhs.indices.size() > rhs.indices.size();
-        });
+    std::vector<Variant> getMineVariants(const ConstraintView &constraints) {
+        std::vector<Variant> variants;
+        VariantEnumerator(constraints).enumerate(variants);
+        return variants;
+    }
 
-        return groups;
+    std::vector<Variant> getMineVariants(const std::vector<Group> &constraints) {
+        return getMineVariants(ConstraintMatrix(constraints).getView(0));
     }
 
-    class BranchIterator {
-    public:
-        explicit BranchIterator(size_t size) : branch_(size) {
+    // Counts over a sorted set of variables: variants[m] - assignments with m mines,
+    // cellMines[m * variables.size() + k] - how many of those put a mine into variables[k]
+    struct CountTable {
+        std::vector<int> variables;
+        std::vector<double> variants;
+        std::vector<double> cellMines;
+
+        explicit CountTable(std::vector<int> vars) : variables(std::move(vars)),
+                                                      variants(variables.size() + 1),
+                                                      cellMines((variables.size() + 1) * variables.size()) {}
+    };
+
+    // counts of the union of two disjoint sets of variables, a convolution over the number of mines
+    CountTable multiplyCounts(const CountTable &lhs, const CountTable &rhs) {
+        std::vector<int> variables;
+        variables.reserve(lhs.variables.size() + rhs.variables.size());
+        std::merge(lhs.variables.begin(), lhs.variables.end(), rhs.variables.begin(), rhs.variables.end(),
+                   std::back_inserter(variables));
+        CountTable product(std::move(variables));
+
+        auto getPositions = [&product](const std::vector<int> &vars) {
+            std::vector<int> positions;
+            positions.reserve(vars.size());
+            for (int var: vars) {
+                positions.push_back(static_cast<int>(
+                        std::lower_bound(product.variables.begin(), product.variables.end(), var) -
+                        product.variables.begin()));
+            }
+            return positions;
+        };
+        auto lhsPositions = getPositions(lhs.variables);
+        auto rhsPositions = getPositions(rhs.variables);
+
+        int size = static_cast<int>(product.variables.size());
+        int lhsSize = static_cast<int>(lhs.variables.size());
+        int rhsSize = static_cast<int>(rhs.variables.size());
+
+        for (int lhsMines = 0; lhsMines <= lhsSize; ++lhsMines) {
+            if (lhs.variants[lhsMines] == 0) {
+                continue;
+            }
+            for (int rhsMines = 0; rhsMines <= rhsSize; ++rhsMines) {
+                if (rhs.variants[rhsMines] == 0) {
+                    continue;
+                }
+                int mines = lhsMines + rhsMines;
+                product.variants[mines] += lhs.variants[lhsMines] * rhs.variants[rhsMines];
+
+                double *cells = product.cellMines.data() + mines * size;
+                for (int k = 0; k < lhsSize; ++k) {
+                    cells[lhsPositions[k]] += lhs.cellMines[lhsMines * lhsSize + k] * rhs.variants[rhsMines];
+                }
+                for (int k = 0; k < rhsSize; ++k) {
+                    cells[rhsPositions[k]] += lhs.variants[lhsMines] * rhs.cellMines[rhsMines * rhsSize + k];
+                }
+            }
+        }
+        return product;
+    }
 
+    size_t ComponentKeyHash::operator()(const std::vector<int> &key) const noexcept {
+        size_t seed = key.size();
+        for (int x: key) {
+            seed ^= static_cast<size_t>(x) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
         }
+        return seed;
+    }
+
+    // Model counting the way #SAT solvers do it: branch on a single cell, propagate, then split the cells
+    // that are still free into independent components and count each of them on its own. A component
+    // is fully described by its cells and the mines left in the constraints over them, so the ones
+    // met again under another branch are taken from the cache instead of being counted twice.
+    class VariantCounter : ConstraintPropagator {
+    public:
+        explicit VariantCounter(const ConstraintView &constraints) : ConstraintPropagator(constraints) {}
 
-        const std::vector<bool> &operator*() const {
-            return branch_;
+        CountTable count() {
+            std::vector<int> variables(values_.size());
+            std::iota(variables.begin(), variables.end(), 0);
+
+            if (!settleAll() || !propagate()) {
+                return CountTable(variables);
+            }
+            return countBranch(0, variables);
         }
 
-        BranchIterator &operator++() {
-            int i = 0;
-            while (i < branch_.size() && branch_[i]) {
-                branch_[i] = false;
-                ++i;
+    private:
+        // counts of variables after the assignments on the trail starting from mark, those are fixed
+        // while the rest is split into components
+        CountTable countBranch(size_t mark, const std::vector<int> &variables) {
+            std::vector<int> fixed(trail_.begin() + static_cast<long>(mark), trail_.end());
+            std::sort(fixed.begin(), fixed.end());
+
+            int mines = 0;
+            for (int var: fixed) {
+                mines += values_[var];
             }
-            if (i == branch_.size()) {
-                overflow_ = true;
-            } else {
-                branch_[i] = true;
+            CountTable counts(fixed);
+            counts.variants[mines] = 1;
+            for (int k = 0; k < fixed.size(); ++k) {
+                counts.cellMines[mines * fixed.size() + k] = values_[fixed[k]];
             }
-            return *this;
+
+            for (const auto &component: split(variables)) {
+                counts = multiplyCounts(counts, countComponent(component));
+            }
+            return counts;
         }
 
-        bool overflow() const {
-            return overflow_;
+        const CountTable &countComponent(const std::vector<int> &component) {
+            auto key = getKey(component);
+            auto found = cache_.find(key);
+            if (found != cache_.end()) {
+                return found->second;
+            }
+
+            int var = component[0];
+            for (int other: component) {
+                if (variableStart_[other + 1] - variableStart_[other] > variableStart_[var + 1] - variableStart_[var]) {
+                    var = other;
+                }
+            }
+
+            CountTable counts(component);
+            for (int8_t value = 0; value < 2; ++value) {
+                size_t mark = trail_.size();
+                if (assign(var, value) && propagate()) {
+                    auto branch = countBranch(mark, component);
+                    for (int k = 0; k < counts.variants.size(); ++k) {
+                        counts.variants[k] += branch.variants[k];
+                    }
+                    for (int k = 0; k < counts.cellMines.size(); ++k) {
+                        counts.cellMines[k] += branch.cellMines[k];
+                    }
+                }
+                undo(mark);
+            }
+
+            return cache_.emplace(std::move(key), std::move(counts)).first->second;
         }
 
     private:
-        std::vector<bool> branch_;
-        bool overflow_ = false;
+        std::unordered_map<std::vector<int>, CountTable, ComponentKeyHash> cache_;
     };
 
-    void setMines(std::vector<Group> constraints, std::unordered_map<int, bool> setVariables,
-                  std::vector<Variant> &variants) {
-        while (!constraints.empty()) {
-            bool reduce = false;
-            while (!constraints.empty()) {
-                if (constraints.back().mines < 0 ||
-                    constraints.back().mines > constraints.back().indices.size()) {
-                    return;
-                } else if (constraints.back().mines == 0 ||
-                           constraints.back().mines == constraints.back().indices.size()) {
-                    reduce = true;
-                    bool set = constraints.back().mines;
-                    for (int var: constraints.back().indices) {
-                        if (setVariables.count(var)) {
-                            if (setVariables.at(var) != set) {
-                                return;
-                            }
-                        } else {
-                            setVariables[var] = set;
+    VariantCount countMineVariants(const ConstraintView &constraints) {
+        auto counts = VariantCounter(constraints).count();
+        return VariantCount{std::move(counts.variants), std::move(counts.cellMines)};
+    }
+
+    VariantCount countMineVariants(const std::vector<Group> &constraints) {
+        return countMineVariants(ConstraintMatrix(constraints).getView(0));
+    }
+
+    VariantCount countVariants(const std::vector<Variant> &variants, int size) {
+        VariantCount counts{std::vector<double>(size + 1), std::vector<double>((size + 1) * size)};
+        for (const auto &variant: variants) {
+            int mines = static_cast<int>(std::count(variant.variables.begin(), variant.variables.end(), true));
+            counts.variants[mines] += 1;
+            for (int k = 0; k < size; ++k) {
+                counts.cellMines[mines * size + k] += variant.variables[k];
+            }
+        }
+        return counts;
+    }
+
+    // Finds the cells every variant agrees on without listing the variants. Each cell that is still a
+    // candidate gets the opposite of its value in a known variant and a search for any variant that
+    // allows it: a contradiction makes the cell part of the backbone, a variant found rules out every
+    // candidate it disagrees with. The search prefers such disagreements, splits the free cells into
+    // components like the counter does and remembers the components it has already solved or refuted.
+    class BackboneFinder : ConstraintPropagator {
+    public:
+        explicit BackboneFinder(const ConstraintView &constraints) : ConstraintPropagator(constraints),
+                                                                        preferred_(values_.size()) {}
+
+        std::vector<int> find() {
+            int size = static_cast<int>(values_.size());
+            std::vector<int> backbone(size, -1);
+            if (!settleAll() || !propagate()) {
+                return backbone;
+            }
+
+            std::vector<int> variables(size);
+            std::iota(variables.begin(), variables.end(), 0);
+            std::vector<int8_t> known(size);
+            if (!search(variables, known)) {
+                return backbone;
+            }
+
+            size_t root = trail_.size();
+            for (int var: trail_) {
+                known[var] = values_[var];
+            }
+            std::vector<bool> candidate(size, true);
+            for (int var = 0; var < size; ++var) {
+                preferred_[var] = static_cast<int8_t>(1 - known[var]);
+            }
+
+            for (int var: order_) {
+                if (!candidate[var]) {
+                    continue;
+                }
+
+                auto variant = known;
+                if (assign(var, static_cast<int8_t>(1 - known[var])) && propagate() && search(variables, variant)) {
+                    for (size_t k = root; k < trail_.size(); ++k) {
+                        variant[trail_[k]] = values_[trail_[k]];
+                    }
+                    for (int other = 0; other < size; ++other) {
+                        if (variant[other] != known[other]) {
+                            candidate[other] = false;
                         }
                     }
-                    constraints.pop_back();
                 } else {
-                    break;
+                    backbone[var] = known[var];
                 }
+                undo(root);
             }
-            if (!reduce) {
-                break;
+            return backbone;
+        }
+
+    private:
+        // looks for values of the free cells among variables that satisfy every constraint
+        bool search(const std::vector<int> &variables, std::vector<int8_t> &variant) {
+            for (const auto &component: split(variables)) {
+                if (!searchComponent(component, variant)) {
+                    return false;
+                }
             }
-            constraints = reduceConstraints(constraints, setVariables);
+            return true;
         }
-        if (constraints.empty()) {
-            std::vector<bool> variant(setVariables.size());
-            for (const auto &[index, variable]: setVariables) {
-                variant[index] = variable;
+
+        bool searchComponent(const std::vector<int> &component, std::vector<int8_t> &variant) {
+            auto key = getKey(component);
+            auto found = solved_.find(key);
+            if (found != solved_.end()) {
+                for (int k = 0; k < found->second.size(); ++k) {
+                    variant[component[k]] = found->second[k];
+                }
+                return !found->second.empty();
             }
-            variants.emplace_back(Variant{variant});
-        } else {
-            auto constraint = std::move(constraints.back());
-            constraints.pop_back();
-
-            BranchIterator it(constraint.indices.size());
-            do {
-                int sum = 0;
-                for (int var: *it) {
-                    sum += var;
-                }
-                if (sum == constraint.mines) {
-                    auto branchSetVariables = setVariables;
-                    for (int i = 0; i < constraint.indices.size(); ++i) {
-                        branchSetVariables[constraint.indices[i]] = (*it)[i];
+
+            int var = component[0];
+            for (int other: component) {
+                if (variableStart_[other + 1] - variableStart_[other] > variableStart_[var + 1] - variableStart_[var]) {
+                    var = other;
+                }
+            }
+
+            size_t mark = trail_.size();
+            for (int8_t value: {preferred_[var], static_cast<int8_t>(1 - preferred_[var])}) {
+                if (assign(var, value) && propagate() && search(component, variant)) {
+                    for (size_t k = mark; k < trail_.size(); ++k) {
+                        variant[trail_[k]] = values_[trail_[k]];
                     }
+                    undo(mark);
 
-                    auto reduced = reduceConstraints(constraints, branchSetVariables);
-                    setMines(reduced, branchSetVariables, variants);
+                    std::vector<int8_t> values;
+                    for (int other: component) {
+                        values.push_back(variant[other]);
+                    }
+                    solved_.emplace(std::move(key), std::move(values));
+                    return true;
                 }
-            } while (!(++it).overflow());
+                undo(mark);
+            }
+
+            solved_.emplace(std::move(key), std::vector<int8_t>());
+            return false;
         }
+
+    private:
+        std::vector<int8_t> preferred_;
+        // values of the solved components, empty for the ones without a variant
+        std::unordered_map<std::vector<int>, std::vector<int8_t>, ComponentKeyHash> solved_;
+    };
+
+    std::vector<int> getMineBackbone(const ConstraintView &constraints) {
+        return BackboneFinder(constraints).find();
     }
 
-    std::vector<Variant> getMineVariants(const std::vector<Group> &constraints) {
-        std::vector<Variant> variants;
-        std::unordered_map<int, bool> setVariables;
-        setMines(reduceConstraints(constraints, setVariables), setVariables, variants);
-        return variants;
+    std::vector<int> getMineBackbone(const std::vector<Group> &constraints) {
+        return getMineBackbone(ConstraintMatrix(constraints).getView(0));
     }
 
-    double diffLogFactorial(int lhs, int rhs) {
-        if (lhs < rhs) {
-            return -diffLogFactorial(rhs, lhs);
+    // the relabelled groups a key stands for, mines, size and the cells of every group one after another
+    ConstraintMatrix getKeyMatrix(const std::vector<int> &key, int cells) {
+        ConstraintMatrix matrix;
+        for (size_t k = 0; k < key.size(); k += 2 + key[k + 1]) {
+            matrix.variables.insert(matrix.variables.end(), key.begin() + static_cast<long>(k) + 2,
+                                    key.begin() + static_cast<long>(k) + 2 + key[k + 1]);
+            matrix.rowStart.push_back(static_cast<int>(matrix.variables.size()));
+            matrix.mines.push_back(key[k]);
         }
-        double diff = 0;
-        for (int i = rhs + 1; i <= lhs; ++i) {
-            diff += std::log(i);
+        matrix.components.push_back({0, matrix.rows(), 0, cells});
+        return matrix;
+    }
+
+    VariantCount ComponentCache::getCounts(const ConstraintView &constraints) {
+        std::vector<int> labels;
+        auto &entry = find(constraints, labels);
+        if (entry.counts) {
+            ++hits_;
+        } else {
+            entry.counts = countMineVariants(getKeyMatrix(entry.key, constraints.cells).getView(0));
         }
-        return diff;
+
+        int size = static_cast<int>(labels.size());
+        VariantCount counts{entry.counts->variants, std::vector<double>(entry.counts->cellMines.size())};
+        for (int mines = 0; mines <= size; ++mines) {
+            for (int var = 0; var < size; ++var) {
+                counts.cellMines[mines * size + var] = entry.counts->cellMines[mines * size + labels[var]];
+            }
+        }
+        return counts;
     }
 
-    std::vector<double> getPositionScore(const std::vector<int> &leftMines, int leftSpace) {
-        int bestMines = *std::max_element(leftMines.begin(), leftMines.end(),
-                                          [leftSpace](const auto &lhs, const auto &rhs) {
-                                              double lhsRate = (double) lhs / leftSpace;
-                                              double rhsRate = (double) rhs / leftSpace;
-                                              return std::abs(lhsRate - 0.5) > std::abs(rhsRate - 0.5);
-                                          });
-        std::vector<double> score;
-        score.reserve(leftMines.size());
-
-        for (int mines: leftMines) {
-            if (mines < 0 || mines > leftSpace) {
-                score.push_back(0);
-            } else {
-                score.push_back(std::exp(diffLogFactorial(bestMines, mines) +
-                                         diffLogFactorial(leftSpace - bestMines, leftSpace - mines)));
+    VariantCount ComponentCache::getCounts(const std::vector<Group> &constraints) {
+        return getCounts(ConstraintMatrix(constraints).getView(0));
+    }
+
+    std::vector<int> ComponentCache::getBackbone(const ConstraintView &constraints) {
+        std::vector<int> labels;
+        auto &entry = find(constraints, labels);
+        if (entry.backbone) {
+            ++hits_;
+        } else {
+            entry.backbone = getMineBackbone(getKeyMatrix(entry.key, constraints.cells).getView(0));
+        }
+
+        std::vector<int> backbone(labels.size());
+        for (int var = 0; var < labels.size(); ++var) {
+            backbone[var] = (*entry.backbone)[labels[var]];
+        }
+        return backbone;
+    }
+
+    std::vector<int> ComponentCache::getBackbone(const std::vector<Group> &constraints) {
+        return getBackbone(ConstraintMatrix(constraints).getView(0));
+    }
+
+    void ComponentCache::clear() {
+        entries_.clear();
+        index_.clear();
+        hits_ = 0;
+        lookups_ = 0;
+    }
+
+    ComponentCache::Entry &ComponentCache::find(const ConstraintView &constraints, std::vector<int> &labels) {
+        ++lookups_;
+
+        // the order of rows carries no meaning, sort them before numbering the cells
+        std::vector<int> rows(constraints.rows);
+        std::iota(rows.begin(), rows.end(), 0);
+        std::sort(rows.begin(), rows.end(), [&constraints](int lhs, int rhs) {
+            const int *left = constraints.variables + constraints.rowStart[lhs];
+            const int *right = constraints.variables + constraints.rowStart[rhs];
+            if (std::equal(left, left + constraints.rowSize(lhs), right, right + constraints.rowSize(rhs))) {
+                return constraints.mines[lhs] < constraints.mines[rhs];
+            }
+            return std::lexicographical_compare(left, left + constraints.rowSize(lhs),
+                                                right, right + constraints.rowSize(rhs));
+        });
+
+        int next = 0;
+        labels.assign(constraints.cells, -1);
+        std::vector<int> key;
+        key.reserve(2 * constraints.rows + constraints.rowStart[constraints.rows] - constraints.rowStart[0]);
+        for (int row: rows) {
+            key.push_back(constraints.mines[row]);
+            key.push_back(constraints.rowSize(row));
+            for (int k = constraints.rowStart[row]; k < constraints.rowStart[row + 1]; ++k) {
+                int var = constraints.variables[k];
+                if (labels[var] < 0) {
+                    labels[var] = next++;
+                }
+                key.push_back(labels[var]);
             }
         }
 
-        return score;
+        auto found = index_.find(key);
+        if (found != index_.end()) {
+            entries_.splice(entries_.begin(), entries_, found->second);
+            return entries_.front();
+        }
+
+        if (entries_.size() >= capacity_) {
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+        }
+        entries_.push_front(Entry{key, std::nullopt, std::nullopt});
+        index_.emplace(std::move(key), entries_.begin());
+        return entries_.front();
+    }
+
+    ComponentCache &getComponentCache() {
+        thread_local ComponentCache cache;
+        return cache;
+    }
+
+    const std::vector<double> &getLogFactorials() {
+        static const std::vector<double> logFactorials = []() {
+            std::vector<double> table(Custom::HEIGHT * Custom::WIDTH + 1);
+            for (int n = 1; n < table.size(); ++n) {
+                table[n] = table[n - 1] + std::log(n);
+            }
+            return table;
+        }();
+        return logFactorials;
     }
 
-    StateAnalysis analyzeState(const State &state) {
-        StateAnalysis analysis = {state};
+    std::vector<double> getPositionScore(const std::vector<int> &leftMines, int leftSpace) {
+        int size = static_cast<int>(leftMines.size());
+        std::vector<double> score(size);
 
-        auto constraints = decoupleMineConstraints(getMineConstraints(state));
-        for (const auto &constraint: constraints) {
-            analysis.coordinates.emplace_back(constraint.coordinates);
+        // the exponents go in a pass of their own once the likeliest count is known
+        double best = -std::numeric_limits<double>::infinity();
+        for (int k = 0; k < size; ++k) {
+            score[k] = getLogBinomial(leftSpace, leftMines[k]);
+            best = std::max(best, score[k]);
+        }
+        if (best == -std::numeric_limits<double>::infinity()) {
+            return std::vector<double>(size);
+        }
+        for (double &s: score) {
+            s = std::exp(s - best);
         }
 
-        for (const auto &constraint: constraints) {
-            analysis.variants.emplace_back(getMineVariants(constraint.groups));
+        return score;
+    }
+
+    AliasTable::AliasTable(const std::vector<double> &weights) : probability_(weights.size()), alias_(weights.size()) {
+        int size = static_cast<int>(weights.size());
+        double sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+        // outcomes below the average lend the rest of their column to outcomes above it
+        std::vector<int> small, large;
+        for (int k = 0; k < size; ++k) {
+            probability_[k] = weights[k] * size / sum;
+            alias_[k] = k;
+            (probability_[k] < 1 ? small : large).push_back(k);
         }
+        while (!small.empty() && !large.empty()) {
+            int less = small.back();
+            int more = large.back();
+            small.pop_back();
+            alias_[less] = more;
+            probability_[more] -= 1 - probability_[less];
+            if (probability_[more] < 1) {
+                large.pop_back();
+                small.push_back(more);
+            }
+        }
+        // whatever is left is 1 up to rounding, except outcomes that cannot happen at all, which rounding
+        // may leave without a partner and which must keep pointing at an outcome that can
+        int likeliest = static_cast<int>(std::max_element(weights.begin(), weights.end()) - weights.begin());
+        for (int k: small) {
+            probability_[k] = weights[k] > 0 ? 1 : 0;
+            alias_[k] = weights[k] > 0 ? k : likeliest;
+        }
+        for (int k: large) {
+            probability_[k] = 1;
+        }
+    }
 
-        for (const auto &coupledVariants: analysis.variants) {
-            std::unordered_map<int, std::vector<int>> variantMines;
-            for (int i = 0; i < coupledVariants.size(); ++i) {
-                int mines = 0;
-                for (int cell: coupledVariants[i].variables) {
-                    mines += cell;
-                }
-                variantMines[mines].push_back(i);
+    std::vector<double> convolveMines(const std::vector<double> &lhs, const std::vector<double> &rhs) {
+        std::vector<double> product(lhs.size() + rhs.size() - 1);
+        for (int i = 0; i < lhs.size(); ++i) {
+            for (int j = 0; j < rhs.size(); ++j) {
+                product[i + j] += lhs[i] * rhs[j];
             }
+        }
+
+        // only ratios between the coefficients matter, keep the largest at 1 so long products stay finite
+        double largest = *std::max_element(product.begin(), product.end());
+        for (double &p: product) {
+            p /= largest;
+        }
+        return product;
+    }
 
-            std::vector<StateAnalysis::VariantGroup> variantGroups;
-            for (const auto &[mines, group]: variantMines) {
-                variantGroups.emplace_back(StateAnalysis::VariantGroup{group, mines});
+    template<class G>
+    StateAnalysis<G> analyzeState(const State<G> &state, AnalysisMode mode) {
+        using VariantGroup = typename StateAnalysis<G>::VariantGroup;
+        StateAnalysis<G> analysis;
+        analysis.state = state;
+
+        auto matrix = getComponentMatrix(state);
+        for (int c = 0; c < matrix.size(); ++c) {
+            auto constraint = matrix.getView(c);
+            analysis.coordinates.emplace_back(constraint.coordinates, constraint.coordinates + constraint.cells);
+            if (mode == AnalysisMode::Variants) {
+                analysis.variants.emplace_back(getMineVariants(constraint));
+                analysis.counts.emplace_back(countVariants(analysis.variants.back(), constraint.cells));
+            } else {
+                analysis.counts.emplace_back(getComponentCache().getCounts(constraint));
             }
-            analysis.condensedVariants.emplace_back(std::move(variantGroups));
         }
 
-        int pivot = 0, size = static_cast<int>(analysis.condensedVariants.size());
-        std::vector<int> index(size);
+        for (int n = 0; n < analysis.counts.size(); ++n) {
+            const auto &counts = analysis.counts[n];
+            std::vector<VariantGroup> variantGroups;
+            std::vector<int> groupIndex(counts.variants.size(), -1);
+            for (int mines = 0; mines < counts.variants.size(); ++mines) {
+                if (counts.variants[mines] > 0) {
+                    groupIndex[mines] = static_cast<int>(variantGroups.size());
+                    variantGroups.emplace_back(VariantGroup{{}, mines, counts.variants[mines]});
+                }
+            }
+            if (variantGroups.empty()) {
+                throw std::invalid_argument("state has no consistent mine layout");
+            }
 
-        int leftSpace = HEIGHT * WIDTH;
-        int leftMines = MINES;
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                if (state[i][j]) {
-                    if (state[i][j] == FLAG) {
-                        --leftMines;
-                    }
-                    --leftSpace;
+            if (mode == AnalysisMode::Variants) {
+                const auto &coupledVariants = analysis.variants[n];
+                for (int i = 0; i < coupledVariants.size(); ++i) {
+                    int mines = static_cast<int>(std::count(coupledVariants[i].variables.begin(),
+                                                            coupledVariants[i].variables.end(), true));
+                    variantGroups[groupIndex[mines]].indices.push_back(i);
                 }
             }
+            analysis.condensedVariants.emplace_back(std::move(variantGroups));
         }
+
+        int size = static_cast<int>(analysis.condensedVariants.size());
+        int leftSpace = state.geometry().cells() - (state.opened() | state.flagged()).count();
+        int leftMines = state.geometry().mines() - state.flagged().count();
         for (const auto &coordinates: analysis.coordinates) {
             leftSpace -= static_cast<int>(coordinates.size());
         }
 
-        std::vector<int> leftCondensedVariantsMines;
-
-        while (true) {
-            int mines = 0;
-            for (int i = 0; i < size; ++i) {
-                mines += analysis.condensedVariants[i][index[i]].mines;
+        // the mine counts of a component as a polynomial, the coefficient of x^m weighs its m mine variants
+        std::vector<std::vector<double>> polynomials;
+        for (const auto &variantGroups: analysis.condensedVariants) {
+            std::vector<double> polynomial(variantGroups.back().mines + 1);
+            for (const auto &group: variantGroups) {
+                polynomial[group.mines] = group.count;
             }
-            leftCondensedVariantsMines.push_back(leftMines - mines);
+            polynomials.emplace_back(std::move(polynomial));
+        }
 
-            analysis.condensedVariantsIndices.push_back(index);
-            while (pivot < size && ++index[pivot] == analysis.condensedVariants[pivot].size()) {
-                index[pivot++] = 0;
+        analysis.componentMines.assign(1, {1});
+        for (int n = 0; n < size; ++n) {
+            analysis.componentMines.emplace_back(convolveMines(analysis.componentMines[n], polynomials[n]));
+        }
+        std::vector<std::vector<double>> suffixMines(size + 1, {1});
+        for (int n = size - 1; n >= 0; --n) {
+            suffixMines[n] = convolveMines(polynomials[n], suffixMines[n + 1]);
+        }
+
+        // the interior takes whatever the frontier leaves, in as many ways as it can place that many mines
+        const auto &frontierMines = analysis.componentMines[size];
+        std::vector<int> leftInteriorMines;
+        for (int mines = 0; mines < frontierMines.size(); ++mines) {
+            leftInteriorMines.push_back(leftMines - mines);
+        }
+        auto score = getPositionScore(leftInteriorMines, leftSpace);
+
+        double interiorMines = 0;
+        analysis.frontierMinesProbability.resize(frontierMines.size());
+        for (int mines = 0; mines < frontierMines.size(); ++mines) {
+            analysis.frontierMinesProbability[mines] = frontierMines[mines] * score[mines];
+        }
+        double scoreSum = std::accumulate(analysis.frontierMinesProbability.begin(),
+                                          analysis.frontierMinesProbability.end(), 0.0);
+        // the components may be satisfiable one by one, yet leave the interior too many or too few mines
+        if (!(scoreSum > 0)) {
+            throw std::invalid_argument("state has no consistent mine layout");
+        }
+        for (int mines = 0; mines < frontierMines.size(); ++mines) {
+            analysis.frontierMinesProbability[mines] /= scoreSum;
+            interiorMines += analysis.frontierMinesProbability[mines] * leftInteriorMines[mines];
+        }
+        analysis.frontierMinesTable = AliasTable(analysis.frontierMinesProbability);
+        (state.unknown() - state.frontier()).forEach([&analysis](int i, int j) {
+            analysis.interior.emplace_back(i, j);
+        });
+
+        // a group of a component is as likely as its variants times the ways the other components and the
+        // interior complete them, the other components being the convolution of those before and after it
+        std::vector<std::vector<double>> groupProbability;
+        for (int n = 0; n < size; ++n) {
+            auto others = convolveMines(analysis.componentMines[n], suffixMines[n + 1]);
+            std::vector<double> probability;
+            for (const auto &group: analysis.condensedVariants[n]) {
+                double completions = 0;
+                for (int mines = 0; mines < others.size(); ++mines) {
+                    completions += others[mines] * score[group.mines + mines];
+                }
+                probability.push_back(group.count * completions);
             }
-            if (pivot == size) {
-                break;
+            double sum = std::accumulate(probability.begin(), probability.end(), 0.0);
+            for (double &p: probability) {
+                p /= sum;
             }
-            pivot = 0;
+            groupProbability.emplace_back(std::move(probability));
         }
 
-        auto score = getPositionScore(leftCondensedVariantsMines, leftSpace);
-        for (int i = 0; i < score.size(); ++i) {
-            for (int j = 0; j < size; ++j) {
-                score[i] *= static_cast<double>(analysis.condensedVariants[j][analysis.condensedVariantsIndices[i][j]].indices.size());
+        // a cell of a component gets the share of its group's variants with a mine there, weighted by
+        // how likely the group is, the cells away from the frontier share the mines left over evenly
+        analysis.mineProbability.assign(G::HEIGHT * G::WIDTH, 0);
+        for (int n = 0; n < size; ++n) {
+            const auto &coordinates = analysis.coordinates[n];
+            int cells = static_cast<int>(coordinates.size());
+            for (int g = 0; g < analysis.condensedVariants[n].size(); ++g) {
+                const auto &group = analysis.condensedVariants[n][g];
+                double weight = groupProbability[n][g] / group.count;
+                for (int k = 0; k < cells; ++k) {
+                    auto [i, j] = coordinates[k];
+                    analysis.mineProbability[i * G::WIDTH + j] +=
+                            weight * analysis.counts[n].cellMines[group.mines * cells + k];
+                }
             }
         }
 
-        double scoreSum = std::accumulate(score.begin(), score.end(), 0.0);
-        for (double &s: score) {
-            s /= scoreSum;
+        double interiorProbability = leftSpace > 0 ? interiorMines / leftSpace : 0;
+        for (auto [i, j]: analysis.interior) {
+            analysis.mineProbability[i * G::WIDTH + j] = interiorProbability;
         }
-
-        analysis.condensedVariantsProbability = std::move(score);
+        state.flagged().forEach([&analysis](int i, int j) {
+            analysis.mineProbability[i * G::WIDTH + j] = 1;
+        });
         return analysis;
     }
+
+    template<class G>
+    typename State<G>::Mask sampleMines(const StateAnalysis<G> &analysis, std::mt19937 &gen) {
+        using VariantGroup = typename StateAnalysis<G>::VariantGroup;
+        auto mines = analysis.state.flagged();
+        int leftMines = analysis.state.geometry().mines() - mines.count();
+
+        // the mines of the whole frontier first, then the share of every component from the last one back,
+        // each group weighed by how many ways the components before it place the rest
+        int frontierMines = analysis.frontierMinesTable.sample(gen);
+        leftMines -= frontierMines;
+        for (int n = static_cast<int>(analysis.condensedVariants.size()) - 1; n >= 0; --n) {
+            const auto &variantGroups = analysis.condensedVariants[n];
+            const auto &before = analysis.componentMines[n];
+            auto weight = [frontierMines, &before](const VariantGroup &group) {
+                int rest = frontierMines - group.mines;
+                return rest >= 0 && rest < before.size() ? group.count * before[rest] : 0.0;
+            };
+
+            double sum = 0;
+            for (const auto &group: variantGroups) {
+                sum += weight(group);
+            }
+            double left = std::uniform_real_distribution<>(0, sum)(gen);
+            int g = 0;
+            for (int k = 0; k < variantGroups.size(); ++k) {
+                double w = weight(variantGroups[k]);
+                if (w > 0) {
+                    g = k;
+                    if ((left -= w) < 0) {
+                        break;
+                    }
+                }
+            }
+            const auto &group = variantGroups[g];
+            frontierMines -= group.mines;
+
+            int chosen = group.indices[std::uniform_int_distribution<>(0, static_cast<int>(group.indices.size()) - 1)(
+                    gen)];
+            const auto &variables = analysis.variants[n][chosen].variables;
+            for (int m = 0; m < variables.size(); ++m) {
+                if (variables[m]) {
+                    auto [i, j] = analysis.coordinates[n][m];
+                    mines.set(i, j);
+                }
+            }
+        }
+
+        // the interior cells hold none of the mines so far
+        sampleCells(static_cast<int>(analysis.interior.size()), leftMines, gen, mines, [&analysis](int index) {
+            return analysis.interior[index];
+        });
+
+        return mines;
+    }
+
+    template<class G>
+    void sampleLayouts(const StateAnalysis<G> &analysis, int n, std::mt19937 &gen, uint8_t *layouts) {
+        int height = analysis.state.height();
+        int width = analysis.state.width();
+        std::fill(layouts, layouts + n * height * width, 0);
+
+        for (int k = 0; k < n; ++k) {
+            uint8_t *layout = layouts + k * height * width;
+            sampleMines(analysis, gen).forEach([layout, width](int i, int j) {
+                layout[i * width + j] = 1;
+            });
+        }
+    }
+
+    template ConstraintMatrix getConstraintMatrix(const State<Beginner> &state);
+    template ConstraintMatrix getConstraintMatrix(const State<Intermediate> &state);
+    template ConstraintMatrix getConstraintMatrix(const State<Expert> &state);
+    template ConstraintMatrix getConstraintMatrix(const State<Custom> &state);
+
+    template ConstraintMatrix getComponentMatrix(const State<Beginner> &state);
+    template ConstraintMatrix getComponentMatrix(const State<Intermediate> &state);
+    template ConstraintMatrix getComponentMatrix(const State<Expert> &state);
+    template ConstraintMatrix getComponentMatrix(const State<Custom> &state);
+
+    template Constraint getMineConstraints(const State<Beginner> &state);
+    template Constraint getMineConstraints(const State<Intermediate> &state);
+    template Constraint getMineConstraints(const State<Expert> &state);
+    template Constraint getMineConstraints(const State<Custom> &state);
+
+    template StateAnalysis<Beginner> analyzeState(const State<Beginner> &state, AnalysisMode mode);
+    template StateAnalysis<Intermediate> analyzeState(const State<Intermediate> &state, AnalysisMode mode);
+    template StateAnalysis<Expert> analyzeState(const State<Expert> &state, AnalysisMode mode);
+    template StateAnalysis<Custom> analyzeState(const State<Custom> &state, AnalysisMode mode);
+
+    template State<Beginner>::Mask sampleMines(const StateAnalysis<Beginner> &analysis, std::mt19937 &gen);
+    template State<Intermediate>::Mask sampleMines(const StateAnalysis<Intermediate> &analysis, std::mt19937 &gen);
+    template State<Expert>::Mask sampleMines(const StateAnalysis<Expert> &analysis, std::mt19937 &gen);
+    template State<Custom>::Mask sampleMines(const StateAnalysis<Custom> &analysis, std::mt19937 &gen);
+
+    template void sampleLayouts(const StateAnalysis<Beginner> &analysis, int n, std::mt19937 &gen, uint8_t *layouts);
+    template void sampleLayouts(const StateAnalysis<Intermediate> &analysis, int n, std::mt19937 &gen,
+                                uint8_t *layouts);
+    template void sampleLayouts(const StateAnalysis<Expert> &analysis, int n, std::mt19937 &gen, uint8_t *layouts);
+    template void sampleLayouts(const StateAnalysis<Custom> &analysis, int n, std::mt19937 &gen, uint8_t *layouts);
 }
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include <exception>
+#include <stdexcept>
+
+#include "selfplay.h"
+
+namespace agent {
+    template<class G>
+    SelfPlay<G>::SelfPlay(int batchSize, int treeIter, int threads, G geometry, uint32_t seed)
+            : geometry_(geometry), batchSize_(batchSize), treeIter_(treeIter), pool_(std::max(threads, 1)) {
+        std::mt19937 gen(seed);
+        for (int i = 0; i < 2 * batchSize_; ++i) {
+            games_.emplace_back(std::make_unique<Game>(gen(), geometry_));
+        }
+
+        for (int half = 0; half < 2; ++half) {
+            states_[half].resize(batchSize_ * geometry_.cells());
+            masks_[half].resize(batchSize_ * geometry_.cells());
+            policy_[half].resize(batchSize_ * geometry_.cells());
+            values_[half].resize(batchSize_);
+            submit(half, [this, half](int index) {
+                prepare(*games_[index]);
+                publish(*games_[index], half, index - half * batchSize_);
+            });
+        }
+    }
+
+    template<class G>
+    int SelfPlay<G>::getBatch() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() {
+            return pending_[current_] == 0;
+        });
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        owned_ = true;
+        return current_;
+    }
+
+    template<class G>
+    void SelfPlay<G>::loadBatch() {
+        checkOwned();
+        int half = current_;
+        current_ ^= 1;
+        owned_ = false;
+
+        submit(half, [this, half](int index) {
+            int k = index - half * batchSize_;
+            advance(*games_[index], policy_[half].data() + k * geometry_.cells(), values_[half][k]);
+            publish(*games_[index], half, k);
+        });
+    }
+
+    template<class G>
+    void SelfPlay<G>::getBatch(uint8_t *states) {
+        int half = getBatch();
+        std::copy(states_[half].begin(), states_[half].end(), states);
+    }
+
+    template<class G>
+    void SelfPlay<G>::loadBatch(const float *policy, const float *values) {
+        checkOwned();
+        int half = current_;
+        if (policy != policy_[half].data()) {
+            std::copy_n(policy, policy_[half].size(), policy_[half].begin());
+        }
+        if (values != values_[half].data()) {
+            std::copy_n(values, values_[half].size(), values_[half].begin());
+        }
+        loadBatch();
+    }
+
+    template<class G>
+    int SelfPlay<G>::getFinishedGames() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return finished_;
+    }
+
+    template<class G>
+    void SelfPlay<G>::setLog(const std::string &prefix, int gamesPerShard) {
+        auto writer = std::make_unique<GameWriter<G>>(prefix, gamesPerShard);
+        std::lock_guard<std::mutex> lock(mutex_);
+        writer_ = std::move(writer);
+    }
+
+    template<class G>
+    void SelfPlay<G>::checkOwned() const {
+        // the workers of the batch may still be running, its buffers and games are not the caller's yet
+        if (!owned_) {
+            throw std::logic_error("batch loaded before it was taken with getBatch");
+        }
+    }
+
+    template<class G>
+    void SelfPlay<G>::submit(int half, std::function<void(int)> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_[half] = batchSize_;
+        }
+
+        for (int k = 0; k < batchSize_; ++k) {
+            int index = half * batchSize_ + k;
+            pool_.submit([this, half, index, task]() {
+                std::exception_ptr caught;
+                try {
+                    task(index);
+                } catch (...) {
+                    caught = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (caught && !error_) {
+                    error_ = caught;
+                }
+                if (--pending_[half] == 0) {
+                    done_.notify_all();
+                }
+            });
+        }
+    }
+
+    template<class G>
+    void SelfPlay<G>::publish(const Game &game, int half, int k) {
+        int height = geometry_.height();
+        int width = geometry_.width();
+        uint8_t *states = states_[half].data() + k * height * width;
+        uint8_t *masks = masks_[half].data() + k * height * width;
+
+        for (int i = 0; i < height; ++i) {
+            const auto &row = game.state[i];
+            for (int j = 0; j < width; ++j) {
+                states[i * width + j] = row[j];
+                masks[i * width + j] = row[j] == 0;
+            }
+        }
+    }
+
+    template<class G>
+    void SelfPlay<G>::advance(Game &game, const float *policy, float value) {
+        // in the order of getPossibleActions
+        auto unknown = game.state.unknown();
+        std::vector<double> p;
+        p.reserve(unknown.count());
+        unknown.forEach([this, &p, policy](int i, int j) {
+            p.push_back(policy[i * geometry_.width() + j]);
+        });
+
+        if (game.task == Task::Initialize) {
+            game.agent.loadState(game.state, std::move(p));
+        } else {
+            game.agent.update(std::move(p), value);
+        }
+        prepare(game);
+    }
+
+    template<class G>
+    void SelfPlay<G>::prepare(Game &game) {
+        while (true) {
+            auto iter = game.agent.getIter();
+            if (iter.has_value() && iter.value() < treeIter_) {
+                auto state = game.agent.explore();
+                if (state.has_value()) {
+                    game.task = Task::Update;
+                    game.state = std::move(state.value());
+                    return;
+                }
+                continue;
+            }
+
+            auto actions = game.agent.getActions(game.board.getState());
+            if (actions.empty()) {
+                game.task = Task::Initialize;
+                game.state = game.board.getState();
+                return;
+            }
+            if (iter.has_value()) {
+                game.board.logSearch(game.agent.getRootActions(), game.agent.getRootVisits());
+            }
+
+            for (auto action: actions) {
+                if (isTerminal(game.board.act(action))) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        if (writer_) {
+                            writer_->write(game.board.getLogs());
+                        }
+                        ++finished_;
+                    }
+                    game.agent = TreeAgent<G>(game.gen);
+                    game.board = LoggingBoard<G>(game.gen, geometry_);
+                    break;
+                }
+            }
+        }
+    }
+
+    template class SelfPlay<game::Beginner>;
+    template class SelfPlay<game::Intermediate>;
+    template class SelfPlay<game::Expert>;
+    template class SelfPlay<game::Custom>;
+}
@@ -11,181 +11,110 @@ namespace game {
         return 0;
     }
 
-    GameResult getStateResult(const State &state) {
-        int open = 0;
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                if (state[i][j] == BOMB) {
-                    return GameResult::Lose;
-                }
-                if (isOpened(state, i, j)) {
-                    ++open;
-                }
-            }
+    template<class G>
+    GameResult getStateResult(const State<G> &state) {
+        if (state.mines().any()) {
+            return GameResult::Lose;
         }
-        if (open == HEIGHT * WIDTH - MINES) {
+        if (state.opened().count() == state.geometry().cells() - state.geometry().mines()) {
             return GameResult::Win;
         }
         return GameResult::Continue;
     }
 
+    template<class G>
+    GameResult getStateResult(const Board<G> &board) {
+        return board.getResult();
+    }
+
+    template<class G>
+    GameResult getStateResult(const PerfectBoard<G> &board) {
+        return board.getResult();
+    }
+
     bool isTerminal(GameResult result) {
         return result != GameResult::Continue;
     }
 
-    std::vector<Action> getPossibleActions(const State &state) {
+    template<class G>
+    std::vector<Action> getPossibleActions(const State<G> &state) {
+        auto unknown = state.unknown();
         std::vector<Action> actions;
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                if (!isOpened(state, i, j) && !isFlagged(state, i, j)) {
-                    actions.emplace_back(Action{i, j, Cell::Open});
-                }
-            }
-        }
+        actions.reserve(unknown.count());
+        unknown.forEach([&actions](int i, int j) {
+            actions.emplace_back(Action{i, j, Cell::Open});
+        });
         return actions;
     }
 
-    Board::Board(std::mt19937 &gen) : gen_(gen) {
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                open_[i][j] = 0;
-                state_[i][j] = 0;
-            }
-        }
-    }
-
-    Board::Board(std::mt19937 &gen, const StateAnalysis &analysis) : gen_(gen), clear_(false) {
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                if (isOpened(analysis.state, i, j)) {
-                    ++openedCells_;
-                }
-                open_[i][j] = analysis.state[i][j];
-                state_[i][j] = 0;
-            }
-        }
-
-        std::vector<double> cumulative(analysis.condensedVariantsProbability.size());
-        std::partial_sum(analysis.condensedVariantsProbability.begin(), analysis.condensedVariantsProbability.end(),
-                         cumulative.begin());
-        auto index = analysis.condensedVariantsIndices[std::distance(cumulative.begin(),
-                                                                     std::lower_bound(cumulative.begin(),
-                                                                                      cumulative.end(),
-                                                                                      std::uniform_real_distribution<>()(
-                                                                                              gen_)))];
-
-        int leftMines = MINES;
-        for (int n = 0; n < index.size(); ++n) {
-            const auto &group = analysis.condensedVariants[n][index[n]];
-            leftMines -= group.mines;
-
-            int chosen = group.indices[std::uniform_int_distribution<>(0, static_cast<int>(group.indices.size()) - 1)(
-                    gen_)];
-            const auto &variant = analysis.variants[n][chosen];
-
-            for (int m = 0; m < variant.variables.size(); ++m) {
-                auto [i, j] = analysis.coordinates[n][m];
-                if (variant.variables[m]) {
-                    state_[i][j] = BOMB;
-                }
-            }
-        }
-
-        std::vector<std::pair<int, int>> indices;
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                if (isFlagged(analysis.state, i, j)) {
-                    state_[i][j] = BOMB;
-                    --leftMines;
-                } else if (!isOpened(analysis.state, i, j) && !isNeighbor(analysis.state, i, j)) {
-                    indices.emplace_back(i, j);
-                }
-            }
-        }
-
-        populateMines(indices, leftMines);
+    template<class G>
+    int getPossibleActions(const State<G> &state, ActionId *actions) {
+        int size = 0;
+        state.unknown().forEach([actions, &size](int i, int j) {
+            actions[size++] = static_cast<ActionId>((i * G::WIDTH + j) << 1);
+        });
+        return size;
     }
 
-    void Board::setMineCount(int i, int j, int count) {
-        state_[i][j] = EMPTY + count;
+    template<class G>
+    Board<G>::Board(std::mt19937 &gen, G geometry) : state_(geometry), open_(geometry), gen_(gen) {
     }
 
+    template<class G>
+    Board<G>::Board(std::mt19937 &gen, const StateAnalysis<G> &analysis) : state_(analysis.state.geometry()),
+                                                                          open_(analysis.state), gen_(gen),
+                                                                          openedCells_(analysis.state.opened().count()),
+                                                                          flaggedCells_(analysis.state.flagged().count()),
+                                                                          lost_(analysis.state.mines().any()),
+                                                                          clear_(false) {
+        frontier_.reset(open_);
 
-    int Board::countNeighborMines(int i, int j) const {
-        int mines = 0;
-        for (int n = std::max(i - 1, 0); n < std::min(i + 2, HEIGHT); ++n) {
-            for (int m = std::max(j - 1, 0); m < std::min(j + 2, WIDTH); ++m) {
-                if (state_[n][m] == BOMB) {
-                    ++mines;
-                }
-            }
-        }
-        return mines;
+        setLayout(sampleMines(analysis, gen_));
     }
 
-    void Board::populateMines(std::vector<std::pair<int, int>> indices, int mines) {
-        std::shuffle(indices.begin(), indices.end(), gen_);
-
-        for (int n = 0; n < mines; ++n) {
-            auto [i, j] = indices[n];
-            state_[i][j] = BOMB;
-        }
-
-        for (int i = 0; i < HEIGHT; ++i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                if (state_[i][j] != BOMB) {
-                    setMineCount(i, j, countNeighborMines(i, j));
-                }
-            }
-        }
+    template<class G>
+    Board<G>::Board(std::mt19937 &gen, G geometry, const Mask &mines)
+            : state_(geometry), open_(geometry), gen_(gen), clear_(false) {
+        setLayout(mines);
     }
 
-    void Board::restart(int i, int j) {
-        std::vector<std::pair<int, int>> indices;
-
-        for (int n = 0; n < HEIGHT; ++n) {
-            for (int m = 0; m < WIDTH; ++m) {
-                indices.emplace_back(n, m);
-            }
-        }
+    template<class G>
+    void Board<G>::setLayout(const Mask &mines) {
+        state_.setLayout(mines);
+        empty_ = state_.board() - dilate(mines);
+    }
 
-        std::swap(indices[i * WIDTH + j], indices.back());
-        indices.pop_back();
-        populateMines(std::move(indices), MINES);
+    template<class G>
+    void Board<G>::restart(int i, int j) {
+        setLayout(LayoutGenerator<G>(state_.geometry()).generate(gen_, i, j));
     }
 
-    GameResult Board::open(int i, int j) {
+    template<class G>
+    GameResult Board<G>::open(int i, int j) {
         if (clear_) {
             restart(i, j);
             clear_ = false;
         }
 
         if (state_[i][j] == BOMB) {
-            open_[i][j] = state_[i][j];
+            openCell(i, j);
             return GameResult::Lose;
         }
 
         if (isOpened(open_, i, j)) {
-            int flags = 0;
-            int mines = 0;
-            bool incorrect = false;
-
-            for (int n = std::max(i - 1, 0); n < std::min(i + 2, HEIGHT); ++n) {
-                for (int m = std::max(j - 1, 0); m < std::min(j + 2, WIDTH); ++m) {
-                    if (state_[n][m] == BOMB && !isFlagged(open_, n, m)) {
-                        incorrect = true;
-                    }
-                    if (state_[n][m] == BOMB) {
-                        ++mines;
-                    }
-                    if (isFlagged(open_, n, m)) {
-                        ++flags;
-                    }
-                }
-            }
+            int flags = open_.flagged().countAround(i, j);
+            int mines = state_.mines().countAround(i, j);
+            bool incorrect = (state_.mines() - open_.flagged()).countAround(i, j) > 0;
+
             if (flags == mines) {
-                openNeighborhood(i, j);
+                Mask cell;
+                cell.set(i, j);
+                openArea(dilate(cell));
                 if (incorrect) {
+                    // a wrong flag leaves a mine around the cell unflagged, the chord opens it as well
+                    ((state_.mines() - open_.flagged()) & dilate(cell)).forEach([this](int n, int m) {
+                        openCell(n, m);
+                    });
                     return GameResult::Lose;
                 }
             }
@@ -193,7 +122,9 @@ namespace game {
         }
 
         if (state_[i][j] == EMPTY) {
-            openNeighborhood(i, j);
+            Mask cell;
+            cell.set(i, j);
+            openArea(cell);
         } else {
             openCell(i, j);
         }
@@ -201,44 +132,86 @@ namespace game {
         return checkWinCondition();
     }
 
-    void Board::openNeighborhood(int i, int j) {
-        openCell(i, j);
-        for (int n = std::max(i - 1, 0); n < std::min(i + 2, HEIGHT); ++n) {
-            for (int m = std::max(j - 1, 0); m < std::min(j + 2, WIDTH); ++m) {
-                if (!isOpened(open_, n, m) && state_[n][m] == EMPTY) {
-                    openNeighborhood(n, m);
-                } else if (state_[n][m] != BOMB) {
-                    openCell(n, m);
-                }
+    template<class G>
+    void Board<G>::openArea(const Mask &seeds) {
+        // the empty cells reachable from the seeds through empty cells not open yet, grown a ring at a time
+        auto closed = state_.board() - open_.opened();
+        auto fill = empty_ & closed;
+        auto area = seeds & fill;
+        while (true) {
+            auto grown = area | (dilate(area) & fill);
+            if (grown == area) {
+                break;
             }
+            area = grown;
         }
+
+        // the area, what borders it and the rest of the seeds, mines aside, each cell opened once
+        auto opened = ((dilate(area) | seeds) & closed) - state_.mines();
+        openedCells_ += opened.count();
+        flaggedCells_ -= (opened & open_.flagged()).count();
+        opened.forEach([this](int i, int j) {
+            open_.set(i, j, state_[i][j]);
+        });
+        frontier_.update(open_, opened);
+        lastOpened_ |= opened;
     }
 
-    void Board::openCell(int i, int j) {
+    template<class G>
+    void Board<G>::openCell(int i, int j) {
         if (!isOpened(open_, i, j)) {
             ++openedCells_;
+            flaggedCells_ -= isFlagged(open_, i, j);
+            lost_ = lost_ || state_[i][j] == BOMB;
+            open_.set(i, j, state_[i][j]);
+            frontier_.update(open_, i, j);
+            lastOpened_.set(i, j);
         }
-        open_[i][j] = state_[i][j];
     }
 
-    void Board::flag(int i, int j) {
-        if (!isOpened(open_, i, j)) {
-            open_[i][j] = FLAG;
+    template<class G>
+    void Board<G>::flag(int i, int j) {
+        if (!isOpened(open_, i, j) && !isFlagged(open_, i, j)) {
+            ++flaggedCells_;
+            open_.set(i, j, FLAG);
+            frontier_.update(open_, i, j);
         }
     }
 
-    const State &Board::getState() const {
+    template<class G>
+    const State<G> &Board<G>::getState() const {
         return open_;
     }
 
-    GameResult Board::checkWinCondition() const {
-        if (openedCells_ == WIDTH * HEIGHT - MINES) {
+    template<class G>
+    GameResult Board<G>::getResult() const {
+        if (lost_) {
+            return GameResult::Lose;
+        }
+        return checkWinCondition();
+    }
+
+    template<class G>
+    const std::vector<Constraint> &Board<G>::getConstraints() {
+        return frontier_.getConstraints(open_);
+    }
+
+    template<class G>
+    std::vector<Constraint> Board<G>::getChangedConstraints() {
+        return frontier_.getChangedConstraints(open_);
+    }
+
+    template<class G>
+    GameResult Board<G>::checkWinCondition() const {
+        if (openedCells_ == open_.geometry().cells() - open_.geometry().mines()) {
             return GameResult::Win;
         }
         return GameResult::Continue;
     }
 
-    GameResult Board::act(Action action) {
+    template<class G>
+    GameResult Board<G>::act(Action action) {
+        lastOpened_ = Mask();
         if (action.cell == Cell::Open) {
             return open(action.i, action.j);
         } else {
@@ -247,24 +220,28 @@ namespace game {
         }
     }
 
-    PerfectBoard::PerfectBoard(std::mt19937 &gen) : board_(gen) {
+    template<class G>
+    PerfectBoard<G>::PerfectBoard(std::mt19937 &gen, G geometry) : board_(gen, geometry) {
     }
 
-    PerfectBoard::PerfectBoard(std::mt19937 &gen, const StateAnalysis &analysis) : board_(gen, analysis) {
+    template<class G>
+    PerfectBoard<G>::PerfectBoard(std::mt19937 &gen, const StateAnalysis<G> &analysis) : board_(gen, analysis) {
     }
 
-    const State &PerfectBoard::getState() const {
+    template<class G>
+    const State<G> &PerfectBoard<G>::getState() const {
         return board_.getState();
     }
 
-    GameResult PerfectBoard::act(Action action) {
+    template<class G>
+    GameResult PerfectBoard<G>::act(Action action) {
         auto result = board_.act(action);
         if (isTerminal(result)) {
             return result;
         }
 
         while (true) {
-            auto actions = agent::getExactActionsWeak(getState());
+            auto actions = agent::getExactActionsWeak(board_.getChangedConstraints());
             if (actions.empty()) {
                 break;
             }
@@ -279,4 +256,39 @@ namespace game {
 
         return GameResult::Continue;
     }
-}
\ No newline at end of file
+
+    template GameResult getStateResult(const State<Beginner> &state);
+    template GameResult getStateResult(const State<Intermediate> &state);
+    template GameResult getStateResult(const State<Expert> &state);
+    template GameResult getStateResult(const State<Custom> &state);
+
+    template GameResult getStateResult(const Board<Beginner> &board);
+    template GameResult getStateResult(const Board<Intermediate> &board);
+    template GameResult getStateResult(const Board<Expert> &board);
+    template GameResult getStateResult(const Board<Custom> &board);
+
+    template GameResult getStateResult(const PerfectBoard<Beginner> &board);
+    template GameResult getStateResult(const PerfectBoard<Intermediate> &board);
+    template GameResult getStateResult(const PerfectBoard<Expert> &board);
+    template GameResult getStateResult(const PerfectBoard<Custom> &board);
+
+    template std::vector<Action> getPossibleActions(const State<Beginner> &state);
+    template std::vector<Action> getPossibleActions(const State<Intermediate> &state);
+    template std::vector<Action> getPossibleActions(const State<Expert> &state);
+    template std::vector<Action> getPossibleActions(const State<Custom> &state);
+
+    template int getPossibleActions(const State<Beginner> &state, ActionId *actions);
+    template int getPossibleActions(const State<Intermediate> &state, ActionId *actions);
+    template int getPossibleActions(const State<Expert> &state, ActionId *actions);
+    template int getPossibleActions(const State<Custom> &state, ActionId *actions);
+
+    template class Board<Beginner>;
+    template class Board<Intermediate>;
+    template class Board<Expert>;
+    template class Board<Custom>;
+
+    template class PerfectBoard<Beginner>;
+    template class PerfectBoard<Intermediate>;
+    template class PerfectBoard<Expert>;
+    template class PerfectBoard<Custom>;
+}
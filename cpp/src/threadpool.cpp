@@ -0,0 +1,83 @@
+#include <exception>
+
+#include "threadpool.h"
+
+namespace agent {
+    ThreadPool::ThreadPool(int threads) {
+        for (int i = 0; i < threads; ++i) {
+            workers_.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            tasks_.clear();
+        }
+        available_.notify_all();
+        for (auto &worker: workers_) {
+            worker.join();
+        }
+    }
+
+    void ThreadPool::submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        available_.notify_one();
+    }
+
+    void ThreadPool::work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                available_.wait(lock, [this]() {
+                    return stopped_ || !tasks_.empty();
+                });
+                if (stopped_) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    void ThreadPool::run(int count, const std::function<void(int)> &task) {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+        int pending = count;
+
+        for (int k = 0; k < count; ++k) {
+            submit([&, k]() {
+                std::exception_ptr caught;
+                try {
+                    task(k);
+                } catch (...) {
+                    caught = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (caught && !error) {
+                    error = caught;
+                }
+                if (--pending == 0) {
+                    done.notify_all();
+                }
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&pending]() {
+            return pending == 0;
+        });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
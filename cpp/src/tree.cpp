@@ -1,94 +1,145 @@
-#include <valarray>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <thread>
 #include "tree.h"
 
 namespace tree {
-    void Tree::moveto(game::State state, std::vector<double> policy) {
-        if (states_.count(state)) {
-            root_ = states_.at(state);
-        } else {
-            root_ = nullptr;
-        }
+    inline int loadVisits(const int &visits) {
+        return __atomic_load_n(&visits, __ATOMIC_RELAXED);
+    }
 
-        std::unordered_set<Node *> states;
-        std::vector<Node *> nodes;
-        if (!root_) {
-            root_ = createNode(state, nullptr, 0);
-            root_->policy = std::move(policy);
-        }
-        rootAnalysis_ = game::analyzeState(state);
-        root_->parent = nullptr;
-        nodes.push_back(root_);
+    inline float loadValue(const float &value) {
+        float result;
+        __atomic_load(&value, &result, __ATOMIC_RELAXED);
+        return result;
+    }
 
-        while (!nodes.empty()) {
-            auto node = nodes.back();
-            nodes.pop_back();
-            states.insert(node);
+    inline void addVisits(int &visits, int delta) {
+        __atomic_fetch_add(&visits, delta, __ATOMIC_RELAXED);
+    }
 
-            for (auto child: node->children) {
-                nodes.push_back(child);
-            }
+    inline void addValue(float &value, float delta) {
+        float expected = loadValue(value);
+        float desired = expected + delta;
+        while (!__atomic_compare_exchange(&value, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            desired = expected + delta;
         }
+    }
 
-        for (const auto &[_, node]: states_) {
-            if (!states.count(node)) {
-                delete node;
+    // nodes keep a byte as their lock so they stay copyable
+    class SpinLock {
+    public:
+        explicit SpinLock(char &flag) : flag_(flag) {
+            while (__atomic_test_and_set(&flag_, __ATOMIC_ACQUIRE)) {
+                std::this_thread::yield();
             }
         }
 
-        states_.clear();
-        for (auto node: states) {
-            states_[node->state] = node;
+        ~SpinLock() {
+            __atomic_clear(&flag_, __ATOMIC_RELEASE);
         }
-    }
 
-    game::PerfectBoard Tree::explore() {
-        int it = 0;
-        while (true) {
-            Node *parent = nullptr;
-            Node *node = root_;
+    private:
+        char &flag_;
+    };
 
-            int actionIndexBest;
-            auto board = game::PerfectBoard(gen_, rootAnalysis_);
+    template<class G>
+    void Tree<G>::moveto(game::State<G> state, std::vector<double> policy) {
+        moveto(game::analyzeState(state), policy);
+    }
 
-            while (node && !(node->terminal)) {
-                int nVisitsSum = 0;
-                double uValues[node->actions.size()];
+    template<class G>
+    void Tree<G>::moveto(game::StateAnalysis<G> analysis, const std::vector<double> &policy) {
+        const auto &state = analysis.state;
+        root_ = findNode(state);
+        if (root_ < 0) {
+            root_ = insertNode(state, createNode(state, game::getStateResult(state), gen_));
+            setPolicy(root_, policy);
+        }
+        rootAnalysis_ = std::move(analysis);
 
-                for (int n: node->nVisits) {
-                    nVisitsSum += n;
+        std::vector<int> reachable(storage_.nodes.size(), -1);
+        std::vector<int> nodes = {root_};
+        reachable[root_] = 0;
+        for (size_t k = 0; k < nodes.size(); ++k) {
+            for (int link = storage_.nodes[nodes[k]].children; link >= 0; link = storage_.links[link].next) {
+                int child = storage_.links[link].node;
+                if (reachable[child] < 0) {
+                    reachable[child] = static_cast<int>(nodes.size());
+                    nodes.push_back(child);
                 }
+            }
+        }
 
-                double uBest;
-                for (int i = 0; i < node->actions.size(); ++i) {
-                    uValues[i] =
-                            node->qValues[i] + CPUCT * node->policy[i] * std::sqrt(nVisitsSum) / (node->nVisits[i] + 1);
-                    if (i == 0 || uBest < uValues[i]) {
-                        uBest = uValues[i];
-                        actionIndexBest = i;
-                    }
-                }
+        // once most of the arenas are garbage the reachable nodes are copied into fresh ones in the order
+        // they were found, and the old arenas go all at once
+        std::vector<int> &moved = reachable;
+        if (2 * nodes.size() < storage_.nodes.size()) {
+            Storage storage;
+            for (size_t k = 0; k < nodes.size(); ++k) {
+                storage.nodes.allocate(1);
+            }
 
-                board.act(node->actions[actionIndexBest]);
+            for (size_t k = 0; k < nodes.size(); ++k) {
+                const Node &node = storage_.nodes[nodes[k]];
+                Node &copy = storage.nodes[static_cast<int>(k)];
+                copy = node;
+                copy.children = -1;
 
-                parent = node;
-                if (states_.count(board.getState())) {
-                    node = states_.at(board.getState());
-                    node->parent = parent;
-                    node->parentActionIndex = actionIndexBest;
-                } else {
-                    node = nullptr;
+                copy.edges = storage.actions.allocate(node.size);
+                storage.visits.allocate(node.size);
+                storage.values.allocate(node.size);
+                storage.priors.allocate(node.size);
+                std::copy_n(storage_.actions.data(node.edges), node.size, storage.actions.data(copy.edges));
+                std::copy_n(storage_.visits.data(node.edges), node.size, storage.visits.data(copy.edges));
+                std::copy_n(storage_.values.data(node.edges), node.size, storage.values.data(copy.edges));
+                std::copy_n(storage_.priors.data(node.edges), node.size, storage.priors.data(copy.edges));
+
+                for (int link = node.children; link >= 0; link = storage_.links[link].next) {
+                    int copyLink = storage.links.allocate(1);
+                    storage.links[copyLink] = Link{moved[storage_.links[link].node], copy.children};
+                    copy.children = copyLink;
                 }
             }
+            storage_ = std::move(storage);
+        } else {
+            for (size_t k = 0; k < nodes.size(); ++k) {
+                moved[nodes[k]] = nodes[k];
+            }
+        }
+
+        ConcurrentMap<uint64_t, Entry> states;
+        states_.forEach([&states, &moved](uint64_t hash, const Entry &entry) {
+            if (moved[entry.node] >= 0) {
+                states.insert(hash, Entry{moved[entry.node], entry.check});
+            }
+        });
 
-            if (!node) {
-                node = createNode(board.getState(), parent, actionIndexBest);
-                states_[board.getState()] = node;
-                parent->children.insert(node);
+        states_ = std::move(states);
+        root_ = moved[root_];
+        updated_ = -1;
+        path_.clear();
+    }
+
+    template<class G>
+    game::PerfectBoard<G> Tree<G>::explore() {
+        int it = 0;
+        while (true) {
+            auto board = game::PerfectBoard<G>(gen_, rootAnalysis_);
+            path_.clear();
+            int node = descend(board, path_, false);
+
+            if (node < 0) {
+                node = insertNode(board.getState(), createNode(board.getState(), board.getResult(), gen_));
+                addChild(path_.back().node, node);
                 updated_ = node;
             }
 
-            if (node->terminal) {
-                propagateValue(node, node->value);
+            if (storage_.nodes[node].terminal) {
+                backup(path_, storage_.nodes[node].value, false);
             } else {
                 return board;
             }
@@ -98,57 +149,302 @@ namespace tree {
         }
     }
 
-    void Tree::updateNode(std::vector<double> policy, double value) {
-        updated_->policy = std::move(policy);
-        updated_->value = value;
-        propagateValue(updated_, value);
+    template<class G>
+    void Tree<G>::updateNode(std::vector<double> policy, double value) {
+        setPolicy(updated_, policy);
+        storage_.nodes[updated_].value = static_cast<float>(value);
+        backup(path_, static_cast<float>(value), false);
+    }
+    template<class G>
+    typename Tree<G>::SearchStats Tree<G>::search(int iterations, int threads, const Evaluator &evaluate) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::mt19937> gens;
+        for (int i = 0; i < threads; ++i) {
+            gens.emplace_back(gen_());
+        }
+
+        std::atomic<int> next(0);
+        std::atomic<int> descents(0);
+        auto work = [&](int worker) {
+            std::vector<Step> path;
+            while (next.fetch_add(1) < iterations) {
+                descents += iterate(gens[worker], path, evaluate);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; ++i) {
+            workers.emplace_back(work, i);
+        }
+        work(0);
+        for (auto &worker: workers) {
+            worker.join();
+        }
+
+        SearchStats stats;
+        stats.threads = threads;
+        stats.iterations = iterations;
+        stats.descents = descents;
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+    template<class G>
+    int Tree<G>::iterate(std::mt19937 &gen, std::vector<Step> &path, const Evaluator &evaluate) {
+        for (int it = 1; ; ++it) {
+            auto board = game::PerfectBoard<G>(gen, rootAnalysis_);
+            path.clear();
+            int node = descend(board, path, true);
+
+            if (node < 0) {
+                // evaluated before it is published, other workers never see a node without its policy.
+                // A node that loses the race for its state stays unreachable until the next moveto
+                node = createNode(board.getState(), board.getResult(), gen);
+                if (!storage_.nodes[node].terminal) {
+                    auto [policy, value] = evaluate(board, gen);
+                    setPolicy(node, policy);
+                    storage_.nodes[node].value = static_cast<float>(value);
+                }
+
+                node = insertNode(board.getState(), node);
+                addChild(path.back().node, node);
+            }
+
+            const Node &leaf = storage_.nodes[node];
+            backup(path, leaf.value, true);
+            if (!leaf.terminal || it == MAXITER) {
+                return it;
+            }
+        }
+    }
+
+    template<class G>
+    int Tree<G>::descend(game::PerfectBoard<G> &board, std::vector<Step> &path, bool virtualLoss) {
+        int node = root_;
+        while (node >= 0 && !storage_.nodes[node].terminal) {
+            int edge = selectAction(node);
+            if (virtualLoss) {
+                addVisits(storage_.visits[edge], 1);
+                addValue(storage_.values[edge], -VIRTUAL_LOSS);
+            }
+            path.push_back(Step{node, edge});
+
+            board.act(game::unpackAction(storage_.actions[edge], G::WIDTH));
+            node = findNode(board.getState());
+            // a transposition reaches a node another parent created, it is linked below this one as well
+            if (node >= 0) {
+                addChild(path.back().node, node);
+            }
+        }
+        return node;
+    }
+
+    template<class G>
+    int Tree<G>::selectAction(int node) const {
+        const Node &n = storage_.nodes[node];
+        const int *visits = storage_.visits.data(n.edges);
+        const float *values = storage_.values.data(n.edges);
+        const float *priors = storage_.priors.data(n.edges);
+
+        int nVisitsSum = 0;
+        for (int i = 0; i < n.size; ++i) {
+            nVisitsSum += loadVisits(visits[i]);
+        }
+        float exploration = CPUCT * std::sqrt(static_cast<float>(nVisitsSum));
+
+        int best = 0;
+        float uBest = 0;
+        for (int i = 0; i < n.size; ++i) {
+            int nVisits = loadVisits(visits[i]);
+            float uValue = loadValue(values[i]) / std::max(nVisits, 1) + exploration * priors[i] / (nVisits + 1);
+            if (i == 0 || uBest < uValue) {
+                uBest = uValue;
+                best = i;
+            }
+        }
+        return n.edges + best;
+    }
+
+    template<class G>
+    void Tree<G>::addChild(int parent, int child) {
+        Node &node = storage_.nodes[parent];
+        SpinLock lock(node.lock);
+        for (int link = node.children; link >= 0; link = storage_.links[link].next) {
+            if (storage_.links[link].node == child) {
+                return;
+            }
+        }
+
+        int link;
+        {
+            SpinLock allocation(allocation_);
+            link = storage_.links.allocate(1);
+        }
+        storage_.links[link] = Link{child, node.children};
+        node.children = link;
     }
 
-    Tree::Node *Tree::createNode(const game::State &state, Node *parent, int parentActionIndex) {
-        auto node = new Node();
-        node->parent = parent;
-        node->parentActionIndex = parentActionIndex;
+    template<class G>
+    void Tree<G>::backup(const std::vector<Step> &path, float value, bool virtualLoss) {
+        for (auto [node, edge]: path) {
+            if (virtualLoss) {
+                addValue(storage_.values[edge], value + VIRTUAL_LOSS);
+            } else {
+                addVisits(storage_.visits[edge], 1);
+                addValue(storage_.values[edge], value);
+            }
+        }
+    }
 
-        node->state = state;
-        node->actions = game::getPossibleActions(state);
-        node->nVisits = std::vector<int>(node->actions.size());
-        node->qValues = std::vector<double>(node->actions.size());
+    template<class G>
+    int Tree<G>::createNode(const game::State<G> &state, game::GameResult result, std::mt19937 &gen) {
+        int size = state.unknown().count();
 
-        std::uniform_real_distribution<> unif(-1e-8, 1e-8);
-        for (double &qValue: node->qValues) {
-            qValue = unif(gen_);
+        int node;
+        int edges;
+        {
+            SpinLock lock(allocation_);
+            node = storage_.nodes.allocate(1);
+            edges = storage_.actions.allocate(size);
+            storage_.visits.allocate(size);
+            storage_.values.allocate(size);
+            storage_.priors.allocate(size);
         }
 
-        auto result = game::getStateResult(state);
-        node->terminal = game::isTerminal(result);
-        if (node->terminal) {
-            node->value = game::getReward(result);
+        Node &n = storage_.nodes[node];
+        n.edges = edges;
+        n.size = size;
+
+        game::getPossibleActions(state, storage_.actions.data(edges));
+
+        // ties between unvisited actions are broken at random
+        std::uniform_real_distribution<float> unif(-1e-8, 1e-8);
+        float *values = storage_.values.data(edges);
+        for (int i = 0; i < size; ++i) {
+            values[i] = unif(gen);
         }
 
+        n.terminal = game::isTerminal(result);
+        n.value = n.terminal ? static_cast<float>(game::getReward(result)) : 0;
+
         return node;
     }
 
-    void Tree::propagateValue(Tree::Node *node, double value) {
-        int action = node->parentActionIndex;
-        node = node->parent;
+    template<class G>
+    int Tree<G>::findNode(const game::State<G> &state) {
+        Entry entry = states_.find(state.hash());
+        if (entry.node >= 0 && entry.check != state.check()) {
+            addVisits(collisions_, 1);
+            return -1;
+        }
+        return entry.node;
+    }
 
-        while (node) {
-            node->qValues[action] =
-                    (node->qValues[action] * node->nVisits[action] + value) / (node->nVisits[action] + 1);
-            ++(node->nVisits[action]);
+    template<class G>
+    int Tree<G>::insertNode(const game::State<G> &state, int node) {
+        Entry entry = states_.insert(state.hash(), Entry{node, state.check()});
+        if (entry.check != state.check()) {
+            addVisits(collisions_, 1);
+            return node;
+        }
+        return entry.node;
+    }
 
-            action = node->parentActionIndex;
-            node = node->parent;
+    template<class G>
+    void Tree<G>::setPolicy(int node, const std::vector<double> &policy) {
+        const Node &n = storage_.nodes[node];
+        std::copy(policy.begin(), policy.end(), storage_.priors.data(n.edges));
+    }
+
+    template<class G>
+    std::vector<game::Action> Tree<G>::getRootActions() const {
+        const Node &root = storage_.nodes[root_];
+        std::vector<game::Action> actions;
+        actions.reserve(root.size);
+        for (int i = 0; i < root.size; ++i) {
+            actions.push_back(game::unpackAction(storage_.actions[root.edges + i], G::WIDTH));
         }
+        return actions;
+    }
+
+    template<class G>
+    std::vector<int> Tree<G>::getRootVisits() const {
+        const Node &root = storage_.nodes[root_];
+        const int *visits = storage_.visits.data(root.edges);
+        return std::vector<int>(visits, visits + root.size);
     }
 
-    game::Action Tree::sampleAction() const {
-        std::vector<int> cumulative(root_->nVisits.size());
-        std::partial_sum(root_->nVisits.begin(), root_->nVisits.end(), cumulative.begin());
+    template<class G>
+    game::Action Tree<G>::sampleAction() const {
+        auto nVisits = getRootVisits();
+        std::vector<int> cumulative(nVisits.size());
+        std::partial_sum(nVisits.begin(), nVisits.end(), cumulative.begin());
 
         size_t index = std::distance(cumulative.begin(),
                                      std::lower_bound(cumulative.begin(), cumulative.end(),
                                                       std::uniform_int_distribution<>(1, cumulative.back())(gen_)));
-        return root_->actions[index];
+        const Node &root = storage_.nodes[root_];
+        return game::unpackAction(storage_.actions[root.edges + static_cast<int>(index)], G::WIDTH);
+    }
+
+    template<class G>
+    Ensemble<G>::Ensemble(std::mt19937 &gen, int size) : gen_(&gen) {
+        if (size == 1) {
+            trees_.emplace_back(gen);
+            return;
+        }
+
+        gens_ = std::make_shared<std::vector<std::mt19937>>();
+        for (int i = 0; i < size; ++i) {
+            gens_->emplace_back(gen());
+        }
+        for (auto &treeGen: *gens_) {
+            trees_.emplace_back(treeGen);
+        }
+    }
+
+    template<class G>
+    void Ensemble<G>::moveto(const game::State<G> &state, const std::vector<double> &policy) {
+        auto analysis = game::analyzeState(state);
+        for (auto &tree: trees_) {
+            tree.moveto(analysis, policy);
+        }
     }
+
+    template<class G>
+    std::vector<int> Ensemble<G>::getRootVisits() const {
+        std::vector<int> nVisits = trees_[0].getRootVisits();
+        for (int k = 1; k < trees_.size(); ++k) {
+            auto treeVisits = trees_[k].getRootVisits();
+            std::transform(nVisits.begin(), nVisits.end(), treeVisits.begin(), nVisits.begin(), std::plus<>());
+        }
+        return nVisits;
+    }
+
+    template<class G>
+    game::Action Ensemble<G>::sampleAction() const {
+        if (trees_.size() == 1) {
+            return trees_[0].sampleAction();
+        }
+
+        auto nVisits = getRootVisits();
+        std::vector<int> cumulative(nVisits.size());
+        std::partial_sum(nVisits.begin(), nVisits.end(), cumulative.begin());
+
+        size_t index = std::distance(cumulative.begin(),
+                                     std::lower_bound(cumulative.begin(), cumulative.end(),
+                                                      std::uniform_int_distribution<>(1, cumulative.back())(*gen_)));
+        return trees_[0].getRootActions()[index];
+    }
+
+    template class Tree<game::Beginner>;
+    template class Tree<game::Intermediate>;
+    template class Tree<game::Expert>;
+    template class Tree<game::Custom>;
+
+    template class Ensemble<game::Beginner>;
+    template class Ensemble<game::Intermediate>;
+    template class Ensemble<game::Expert>;
+    template class Ensemble<game::Custom>;
 }
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "layout.h"
+#include "state.h"
+
+using namespace game;
+using Mask = State<Expert>::Mask;
+
+const int HEIGHT = Expert::HEIGHT;
+const int WIDTH = Expert::WIDTH;
+
+int countBruteForce(const Mask &mask, int i, int j) {
+    int count = 0;
+    for (int n = std::max(i - 1, 0); n < std::min(i + 2, HEIGHT); ++n) {
+        for (int m = std::max(j - 1, 0); m < std::min(j + 2, WIDTH); ++m) {
+            if ((n != i || m != j) && mask.test(n, m)) {
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+void testNeighborCount(std::mt19937 &gen) {
+    Mask mask;
+    for (int i = 0; i < HEIGHT; ++i) {
+        for (int j = 0; j < WIDTH; ++j) {
+            if (std::bernoulli_distribution(0.3)(gen)) {
+                mask.set(i, j);
+            }
+        }
+    }
+
+    auto counts = countNeighbors(mask);
+    auto near = dilate(mask);
+    int errors = 0;
+
+    for (int i = 0; i < HEIGHT; ++i) {
+        for (int j = 0; j < WIDTH; ++j) {
+            int count = counts[0].test(i, j) | counts[1].test(i, j) << 1 |
+                        counts[2].test(i, j) << 2 | counts[3].test(i, j) << 3;
+            int expected = countBruteForce(mask, i, j);
+
+            if (count != expected) {
+                ++errors;
+            }
+            if (mask.countAround(i, j) != expected + mask.test(i, j)) {
+                ++errors;
+            }
+            if (near.test(i, j) != (expected + mask.test(i, j) > 0)) {
+                ++errors;
+            }
+        }
+    }
+
+    std::cout << "neighbor count errors: " << errors << std::endl;
+}
+
+void testState() {
+    State<Expert> state;
+    state.set(0, 0, EMPTY);
+    state.set(0, 1, EMPTY + 1);
+    state.set(1, 1, FLAG);
+    state.set(HEIGHT - 1, WIDTH - 1, BOMB);
+
+    std::cout << "opened " << state.opened().count() << " flagged " << state.flagged().count()
+              << " mines " << state.mines().count() << " unknown " << state.unknown().count()
+              << " frontier " << state.frontier().count() << std::endl;
+}
+
+// hashes kept up by set depend on the cells only, not on the order they were written in
+void testZobrist(std::mt19937 &gen) {
+    int errors = 0;
+    for (int it = 0; it < 100; ++it) {
+        State<Expert> state;
+        std::vector<std::pair<int, int>> cells;
+        for (int i = 0; i < HEIGHT; ++i) {
+            for (int j = 0; j < WIDTH; ++j) {
+                state.set(i, j, std::uniform_int_distribution<>(0, BOMB)(gen));
+                cells.emplace_back(i, j);
+            }
+        }
+
+        State<Expert> shuffled;
+        std::shuffle(cells.begin(), cells.end(), gen);
+        for (auto [i, j]: cells) {
+            shuffled.set(i, j, std::uniform_int_distribution<>(0, BOMB)(gen));
+            shuffled.set(i, j, state[i][j]);
+        }
+        errors += shuffled.hash() != state.hash() || shuffled.check() != state.check();
+
+        auto [i, j] = cells[0];
+        shuffled.set(i, j, (state[i][j] + 1) % (BOMB + 1));
+        errors += shuffled.hash() == state.hash() || shuffled.check() == state.check();
+
+        // a layout written at once has to hash as the same layout written cell by cell
+        State<Expert> layout, hidden;
+        layout.setLayout(state.mines());
+        auto counts = countNeighbors(state.mines());
+        for (int n = 0; n < HEIGHT; ++n) {
+            for (int m = 0; m < WIDTH; ++m) {
+                int count = counts[0].test(n, m) | counts[1].test(n, m) << 1 | counts[2].test(n, m) << 2 |
+                            counts[3].test(n, m) << 3;
+                hidden.set(n, m, state.mines().test(n, m) ? BOMB : EMPTY + count);
+            }
+        }
+        errors += layout != hidden || layout.opened() != hidden.opened() || layout.mines() != hidden.mines() ||
+                  layout.hash() != hidden.hash() || layout.check() != hidden.check();
+    }
+
+    std::cout << "zobrist errors: " << errors << " empty hash " << State<Expert>().hash() << std::endl;
+}
+
+// layouts have every mine of the geometry, none in the exclusion zone and the other cells equally likely
+template<class G>
+void testLayoutGenerator(std::mt19937 &gen, G geometry, FirstClick firstClick, int boards) {
+    LayoutGenerator<G> generator(geometry, firstClick);
+    int height = geometry.height();
+    int width = geometry.width();
+    int i = height / 2, j = width / 2;
+
+    int zone = (firstClick == FirstClick::Opening && geometry.cells() - 9 >= geometry.mines()) ? 1 : 0;
+    auto excluded = [i, j, zone](int n, int m) {
+        return std::abs(n - i) <= zone && std::abs(m - j) <= zone;
+    };
+
+    int errors = 0;
+    std::vector<int> frequency(height * width);
+    for (int k = 0; k < boards; ++k) {
+        auto mines = generator.generate(gen, i, j);
+        errors += mines.count() != geometry.mines();
+        mines.forEach([&](int n, int m) {
+            errors += n >= height || m >= width || excluded(n, m);
+            ++frequency[n * width + m];
+        });
+    }
+
+    double expected = geometry.mines() / static_cast<double>(geometry.cells() - (2 * zone + 1) * (2 * zone + 1));
+    double deviation = 0;
+    for (int n = 0; n < height; ++n) {
+        for (int m = 0; m < width; ++m) {
+            if (!excluded(n, m)) {
+                deviation = std::max(deviation, std::abs(frequency[n * width + m] / double(boards) - expected));
+            }
+        }
+    }
+
+    // a board is its layout and the mine counts around every cell
+    State<G> state(geometry);
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < boards; ++k) {
+        state.setLayout(generator.generate(gen, i, j));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "layouts " << height << "x" << width << " opening " << (firstClick == FirstClick::Opening)
+              << " checked " << boards << " errors " << errors << " largest deviation " << deviation
+              << " boards per second " << boards / seconds << std::endl;
+}
+
+int main() {
+    std::mt19937 gen(42);
+    for (int i = 0; i < 10; ++i) {
+        testNeighborCount(gen);
+    }
+    testState();
+    testZobrist(gen);
+    testLayoutGenerator(gen, Expert(), FirstClick::Cell, 100000);
+    testLayoutGenerator(gen, Expert(), FirstClick::Opening, 100000);
+    testLayoutGenerator(gen, Custom(3, 3, 5), FirstClick::Opening, 100000);
+    return 0;
+}
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <set>
+
+#include "agent.h"
+
+using namespace game;
+
+using Component = std::set<std::pair<std::set<std::pair<int, int>>, int>>;
+
+std::multiset<Component> canonicalize(const std::vector<Constraint> &constraints) {
+    std::multiset<Component> components;
+    for (const auto &[groups, coordinates]: constraints) {
+        Component component;
+        for (const auto &group: groups) {
+            std::set<std::pair<int, int>> cells;
+            for (int index: group.indices) {
+                cells.insert(coordinates[index]);
+            }
+            component.emplace(cells, group.mines);
+        }
+        components.insert(component);
+    }
+    return components;
+}
+
+template<class G>
+void testIncrementalConstraints(std::mt19937 &gen, int games, G geometry = G()) {
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<G> board(gen, geometry);
+        while (true) {
+            auto actions = agent::getExactActionsWeak(board.getState());
+            if (actions.empty()) {
+                auto possible = getPossibleActions(board.getState());
+                actions = {possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]};
+            }
+
+            bool terminal = false;
+            for (auto action: actions) {
+                terminal = terminal || isTerminal(board.act(action));
+            }
+            if (terminal) {
+                break;
+            }
+
+            ++checks;
+            if (canonicalize(board.getConstraints()) !=
+                canonicalize(decoupleMineConstraints(getMineConstraints(board.getState())))) {
+                ++errors;
+            }
+        }
+    }
+
+    std::cout << "incremental constraints checked " << checks << " errors " << errors << std::endl;
+}
+
+// autoplay that only solves changed components has to stop where solving all of them would
+template<class G>
+void testChangedConstraints(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<G> board(gen);
+        bool terminal = false;
+
+        while (!terminal) {
+            auto possible = getPossibleActions(board.getState());
+            auto action = possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)];
+            terminal = isTerminal(board.act(action));
+
+            while (!terminal) {
+                auto actions = agent::getExactActionsWeak(board.getChangedConstraints());
+                if (actions.empty()) {
+                    break;
+                }
+                for (auto a: actions) {
+                    terminal = terminal || isTerminal(board.act(a));
+                }
+            }
+
+            if (!terminal) {
+                ++checks;
+                if (!agent::getExactActionsWeak(board.getConstraints()).empty()) {
+                    ++errors;
+                }
+            }
+        }
+    }
+
+    std::cout << "changed constraints autoplay checked " << checks << " errors " << errors << std::endl;
+}
+
+// counters a board keeps up have to agree with a look at its whole state
+template<class G>
+void testBoardCounters(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<G> board(gen);
+        while (true) {
+            auto possible = getPossibleActions(board.getState());
+            auto action = possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)];
+            if (std::bernoulli_distribution(0.2)(gen)) {
+                action.cell = Cell::Flag;
+            }
+            board.act(action);
+
+            const auto &state = board.getState();
+            ++checks;
+            if (board.getOpenedCells() != state.opened().count() || board.getFlaggedCells() != state.flagged().count() ||
+                board.isLost() != state.mines().any() || getStateResult(board) != getStateResult(state) ||
+                board.getHash() != state.hash()) {
+                ++errors;
+            }
+            if (isTerminal(getStateResult(board)) || possible.size() == 1) {
+                break;
+            }
+        }
+    }
+
+    std::cout << "board counters checked " << checks << " errors " << errors << std::endl;
+}
+
+// a chord around a wrong flag loses, and the board has to say so afterwards as well
+template<class G>
+void testWrongChord(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        // mine at (0, 0), the opened (1, 1) next to it, a flag on (0, 1) where there is none
+        typename State<G>::Mask mines;
+        mines.set(0, 0);
+        for (int k = 1; k < G::mines(); ++k) {
+            int index = std::uniform_int_distribution<>(3 * G::width(), G::cells() - 1)(gen);
+            mines.set(index / G::width(), index % G::width());
+        }
+        Board<G> board(gen, G(), mines);
+        board.act({1, 1, Cell::Open});
+        if (board.getState()[1][1] != EMPTY + 1) {
+            continue;
+        }
+        board.act({0, 1, Cell::Flag});
+
+        ++checks;
+        auto result = board.act({1, 1, Cell::Open});
+        const auto &state = board.getState();
+        if (result != GameResult::Lose || board.getResult() != GameResult::Lose || !board.isLost() ||
+            getStateResult(state) != GameResult::Lose || getStateResult(board) != GameResult::Lose ||
+            state[0][0] != BOMB || board.getOpenedCells() != state.opened().count()) {
+            ++errors;
+        }
+    }
+
+    std::cout << "wrong chord checked " << checks << " errors " << errors << std::endl;
+}
+
+// cells opened by the old recursive rules: an empty cell opens its neighbors and recurses into the empty ones
+// not open yet, a chord does the same around the cell, mines are never opened by either
+template<class G>
+typename State<G>::Mask getOpenedSlow(const State<G> &hidden, const State<G> &visible, int i, int j) {
+    auto opened = visible.opened();
+    std::function<void(int, int)> openNeighborhood = [&](int i, int j) {
+        opened.set(i, j);
+        for (int n = std::max(i - 1, 0); n < std::min(i + 2, hidden.height()); ++n) {
+            for (int m = std::max(j - 1, 0); m < std::min(j + 2, hidden.width()); ++m) {
+                if (!opened.test(n, m) && hidden[n][m] == EMPTY) {
+                    openNeighborhood(n, m);
+                } else if (hidden[n][m] != BOMB) {
+                    opened.set(n, m);
+                }
+            }
+        }
+    };
+
+    if (hidden[i][j] == BOMB) {
+        opened.set(i, j);
+    } else if (isOpened(visible, i, j)) {
+        if (visible.flagged().countAround(i, j) == hidden.mines().countAround(i, j)) {
+            openNeighborhood(i, j);
+        }
+    } else if (hidden[i][j] == EMPTY) {
+        openNeighborhood(i, j);
+    } else {
+        opened.set(i, j);
+    }
+    return opened;
+}
+
+// the flood fill has to open what the recursion opened, report exactly those cells and lose on a wrong chord
+template<class G>
+void testFloodFill(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<G> board(gen);
+        auto possible = getPossibleActions(board.getState());
+        board.act(possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]);
+
+        State<G> hidden;
+        hidden.setLayout(board.getMines());
+        while (!isTerminal(getStateResult(board))) {
+            auto visible = board.getState();
+            possible = getPossibleActions(visible);
+            auto action = possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)];
+            double kind = std::uniform_real_distribution<>()(gen);
+            if (kind < 0.3) {
+                // chord on an opened cell
+                std::vector<Action> numbers;
+                (visible.opened() & dilate(visible.unknown())).forEach([&numbers](int i, int j) {
+                    numbers.push_back(Action{i, j, Cell::Open});
+                });
+                action = numbers[std::uniform_int_distribution<>(0, static_cast<int>(numbers.size()) - 1)(gen)];
+            } else if (kind < 0.5) {
+                action.cell = Cell::Flag;
+            }
+
+            auto expected = action.cell == Cell::Open ? getOpenedSlow(hidden, visible, action.i, action.j)
+                                                      : visible.opened();
+            bool wrongChord = isOpened(visible, action.i, action.j) &&
+                              visible.flagged().countAround(action.i, action.j) ==
+                              hidden.mines().countAround(action.i, action.j) &&
+                              (hidden.mines() - visible.flagged()).countAround(action.i, action.j) > 0;
+            auto result = board.act(action);
+
+            ++checks;
+            const auto &state = board.getState();
+            if (state.opened() != expected || board.getLastOpened() != expected - visible.opened() ||
+                (wrongChord && result != GameResult::Lose) ||
+                canonicalize(board.getConstraints()) !=
+                canonicalize(decoupleMineConstraints(getMineConstraints(state)))) {
+                ++errors;
+            }
+            if (wrongChord) {
+                break;
+            }
+        }
+    }
+
+    std::cout << "flood fill checked " << checks << " errors " << errors << std::endl;
+}
+
+// ids of the legal actions have to name what getPossibleActions lists, in the same order, and survive packing
+template<class G>
+void testActionIds(std::mt19937 &gen, int games, G geometry = G()) {
+    int checks = 0;
+    int errors = 0;
+
+    std::vector<State<G>> states;
+    std::vector<ActionId> ids(G::HEIGHT * G::WIDTH);
+    for (int game = 0; game < games; ++game) {
+        Board<G> board(gen, geometry);
+        while (true) {
+            const auto &state = board.getState();
+            states.push_back(state);
+
+            auto actions = getPossibleActions(state);
+            int size = getPossibleActions(state, ids.data());
+            ++checks;
+            bool equal = size == actions.size();
+            for (int k = 0; equal && k < size; ++k) {
+                auto action = unpackAction(ids[k], G::WIDTH);
+                auto flag = Action{action.i, action.j, Cell::Flag};
+                auto played = unpackAction(packAction(flag, geometry.width()), geometry.width());
+                equal = action.i == actions[k].i && action.j == actions[k].j && action.cell == Cell::Open &&
+                        packAction(action, G::WIDTH) == ids[k] && played.i == action.i && played.j == action.j &&
+                        played.cell == Cell::Flag;
+            }
+            if (!equal) {
+                ++errors;
+            }
+
+            auto action = actions[std::uniform_int_distribution<>(0, static_cast<int>(actions.size()) - 1)(gen)];
+            if (isTerminal(board.act(action))) {
+                break;
+            }
+        }
+    }
+
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &state: states) {
+        sink += getPossibleActions(state).size();
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (const auto &state: states) {
+        sink -= getPossibleActions(state, ids.data());
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << "action ids " << geometry.height() << "x" << geometry.width() << " checked " << checks
+              << " errors " << errors + (sink != 0) << " speedup over lists "
+              << std::chrono::duration<double>(middle - start).count() /
+                 std::chrono::duration<double>(end - middle).count() << std::endl;
+}
+
+// components of the split matrix tile its rows and cells, each row stays inside its component, each
+// component is connected and together they hold the whole frontier
+bool getMatrixValidity(const ConstraintMatrix &matrix, int frontier) {
+    int rowOffset = 0, cellOffset = 0;
+    for (const auto &[rowBegin, rowEnd, cellBegin, cellEnd]: matrix.components) {
+        if (rowBegin != rowOffset || cellBegin != cellOffset || rowEnd <= rowBegin || cellEnd <= cellBegin) {
+            return false;
+        }
+        rowOffset = rowEnd;
+        cellOffset = cellEnd;
+
+        int cells = cellEnd - cellBegin;
+        std::vector<bool> reached(cells);
+        std::vector<bool> used(rowEnd - rowBegin);
+        reached[0] = true;
+        for (bool grown = true; grown;) {
+            grown = false;
+            for (int r = rowBegin; r < rowEnd; ++r) {
+                bool touches = false;
+                for (int k = matrix.rowStart[r]; k < matrix.rowStart[r + 1]; ++k) {
+                    int variable = matrix.variables[k];
+                    if (variable < 0 || variable >= cells) {
+                        return false;
+                    }
+                    touches = touches || reached[variable];
+                }
+                if (touches && !used[r - rowBegin]) {
+                    used[r - rowBegin] = grown = true;
+                    for (int k = matrix.rowStart[r]; k < matrix.rowStart[r + 1]; ++k) {
+                        reached[matrix.variables[k]] = true;
+                    }
+                }
+            }
+        }
+        if (std::count(reached.begin(), reached.end(), false) || std::count(used.begin(), used.end(), false)) {
+            return false;
+        }
+    }
+    return rowOffset == matrix.rows() && cellOffset == frontier && matrix.coordinates.size() == frontier;
+}
+
+template<class G>
+void testConstraintMatrix(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<G> board(gen);
+        while (true) {
+            auto actions = agent::getExactActionsWeak(board.getState());
+            if (actions.empty()) {
+                auto possible = getPossibleActions(board.getState());
+                actions = {possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]};
+            }
+
+            bool terminal = false;
+            for (auto action: actions) {
+                terminal = terminal || isTerminal(board.act(action));
+            }
+            if (terminal) {
+                break;
+            }
+
+            const auto &state = board.getState();
+            auto matrix = getComponentMatrix(state);
+            ++checks;
+            if (!getMatrixValidity(matrix, state.frontier().count()) ||
+                canonicalize(decoupleMineConstraints(getMineConstraints(state))) !=
+                canonicalize(board.getConstraints())) {
+                ++errors;
+            }
+
+            // solvers read the components in place the way they read them copied out
+            for (int c = 0; c < matrix.size(); ++c) {
+                auto view = matrix.getView(c);
+                auto groups = matrix.getConstraint(c).groups;
+                if (view.cells > 24) {
+                    continue;
+                }
+                ++checks;
+                if (getMineBackbone(view) != getMineBackbone(groups) ||
+                    countMineVariants(view).variants != countMineVariants(groups).variants) {
+                    ++errors;
+                }
+            }
+        }
+    }
+
+    std::cout << "constraint matrix checked " << checks << " errors " << errors << std::endl;
+}
+
+int main() {
+    std::mt19937 gen(42);
+    testIncrementalConstraints<Beginner>(gen, 100);
+    testIncrementalConstraints<Expert>(gen, 100);
+    testIncrementalConstraints<Custom>(gen, 20, Custom(20, 32, 100));
+    testChangedConstraints<Expert>(gen, 100);
+    testBoardCounters<Expert>(gen, 100);
+    testWrongChord<Expert>(gen, 100);
+    testFloodFill<Expert>(gen, 100);
+    testActionIds<Expert>(gen, 100);
+    testActionIds<Custom>(gen, 20, Custom(20, 25, 80));
+    testConstraintMatrix<Expert>(gen, 50);
+    return 0;
+}
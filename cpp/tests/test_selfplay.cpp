@@ -0,0 +1,237 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include "selfplay.h"
+
+using namespace game;
+
+// a stand-in for the network: uniform policy and a value made up from the state, so that
+// the games depend on nothing but their states and their generators. With buffers the batches
+// are read and answered in the buffers of the self-play instead of copies
+template<class G>
+std::vector<uint64_t> run(int batchSize, int treeIter, int threads, int batches, bool buffers) {
+    G geometry;
+    agent::SelfPlay<G> selfPlay(batchSize, treeIter, threads, geometry);
+
+    int cells = geometry.cells();
+    std::vector<uint8_t> states(batchSize * cells);
+    std::vector<float> policy(batchSize * cells, 1.0f / static_cast<float>(cells));
+    std::vector<float> values(batchSize);
+    std::vector<uint64_t> hashes;
+    int maskErrors = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int batch = 0; batch < batches; ++batch) {
+        int half = selfPlay.getBatch();
+        const uint8_t *s = selfPlay.getStates(half);
+        const uint8_t *masks = selfPlay.getMasks(half);
+        float *v = values.data();
+        if (buffers) {
+            std::copy(policy.begin(), policy.end(), selfPlay.getPolicy(half));
+            v = selfPlay.getValues(half);
+        } else {
+            std::copy(s, s + batchSize * cells, states.data());
+            s = states.data();
+        }
+
+        uint64_t hash = 0;
+        for (int k = 0; k < batchSize; ++k) {
+            int opened = 0;
+            for (int i = 0; i < cells; ++i) {
+                hash = hash * 31 + s[k * cells + i];
+                opened += s[k * cells + i] >= EMPTY;
+                maskErrors += masks[k * cells + i] != (s[k * cells + i] == 0);
+            }
+            v[k] = static_cast<float>(opened % 3 - 1);
+        }
+        hashes.push_back(hash);
+
+        if (buffers) {
+            selfPlay.loadBatch();
+        } else {
+            selfPlay.loadBatch(policy.data(), values.data());
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "threads " << threads << " batches " << batches << " games " << selfPlay.getFinishedGames()
+              << " mask errors " << maskErrors << " states per second " << batches * batchSize / seconds << std::endl;
+    return hashes;
+}
+
+// a batch can only be loaded once, after getBatch handed it over
+template<class G>
+void testBatchOwnership(int batchSize, int treeIter) {
+    agent::SelfPlay<G> selfPlay(batchSize, treeIter, 2);
+    int errors = 0;
+    auto load = [&selfPlay]() {
+        try {
+            selfPlay.loadBatch();
+            return true;
+        } catch (const std::logic_error &) {
+            return false;
+        }
+    };
+
+    errors += load();
+    selfPlay.getBatch();
+    errors += !load();
+    errors += load();
+    selfPlay.getBatch();
+    selfPlay.getBatch();
+    errors += !load();
+
+    std::cout << "batch ownership errors " << errors << std::endl;
+}
+
+void removeShards(const std::string &prefix) {
+    for (int shard = 0; std::filesystem::exists(agent::GameWriter<Beginner>::getShardName(prefix, shard)); ++shard) {
+        std::filesystem::remove(agent::GameWriter<Beginner>::getShardName(prefix, shard));
+    }
+}
+
+// a prefix that cannot be written to fails in setLog, a shard that cannot be opened later on fails in getBatch
+template<class G>
+void testLogFailure(int batchSize, int treeIter) {
+    auto prefix = (std::filesystem::temp_directory_path() / "test_selfplay_failure").string();
+    removeShards(prefix);
+
+    int errors = 0;
+    {
+        agent::SelfPlay<G> selfPlay(batchSize, treeIter, 2);
+        try {
+            selfPlay.setLog((std::filesystem::temp_directory_path() / "missing" / "test_selfplay").string());
+            ++errors;
+        } catch (const std::runtime_error &) {
+        }
+
+        // every game goes to a shard of its own and the second one is a directory
+        selfPlay.setLog(prefix, 1);
+        std::filesystem::create_directory(agent::GameWriter<G>::getShardName(prefix, 1));
+
+        G geometry;
+        std::vector<float> policy(batchSize * geometry.cells(), 1.0f / static_cast<float>(geometry.cells()));
+        std::vector<float> values(batchSize);
+        bool thrown = false;
+        for (int batch = 0; batch < 1000 && !thrown; ++batch) {
+            try {
+                selfPlay.getBatch();
+                selfPlay.loadBatch(policy.data(), values.data());
+            } catch (const std::runtime_error &) {
+                thrown = true;
+            }
+        }
+        errors += !thrown;
+        try {
+            selfPlay.getBatch();
+            ++errors;
+        } catch (const std::runtime_error &) {
+        }
+    }
+
+    removeShards(prefix);
+    std::cout << "log failure errors " << errors << std::endl;
+}
+
+// the first record of a shard with its size field zeroed or cut short has to be refused, not read past
+template<class G>
+int getDamagedRecordErrors(const std::string &name, G geometry) {
+    std::ifstream file(name, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    int errors = 0;
+    uint32_t size;
+    std::memcpy(&size, data.data() + 4, sizeof(size));
+    for (uint32_t damaged: {0U, size - 4}) {
+        auto copy = data;
+        std::memcpy(copy.data() + 4, &damaged, sizeof(damaged));
+        auto path = name + ".damaged";
+        std::ofstream(path, std::ios::binary).write(copy.data(), static_cast<std::streamsize>(copy.size()));
+        try {
+            agent::readGames(path, geometry);
+            ++errors;
+        } catch (const std::runtime_error &) {
+        }
+        std::filesystem::remove(path);
+    }
+    return errors;
+}
+
+// games read back from the shards have to replay to the result they were logged with
+template<class G>
+void testGameLog(int batchSize, int treeIter, int batches) {
+    G geometry;
+    auto prefix = (std::filesystem::temp_directory_path() / "test_selfplay").string();
+    removeShards(prefix);
+
+    {
+        // the workers are done writing once the self-play is gone
+        agent::SelfPlay<G> selfPlay(batchSize, treeIter, 2, geometry);
+        selfPlay.setLog(prefix, 16);
+
+        int cells = geometry.cells();
+        std::vector<float> policy(batchSize * cells, 1.0f / static_cast<float>(cells));
+        std::vector<float> values(batchSize);
+        for (int batch = 0; batch < batches; ++batch) {
+            selfPlay.getBatch();
+            selfPlay.loadBatch(policy.data(), values.data());
+        }
+    }
+
+    int games = 0;
+    int errors = 0;
+    size_t bytes = 0;
+    for (int shard = 0; std::filesystem::exists(agent::GameWriter<G>::getShardName(prefix, shard)); ++shard) {
+        auto name = agent::GameWriter<G>::getShardName(prefix, shard);
+        bytes += std::filesystem::file_size(name);
+
+        for (const auto &log: agent::readGames(name, geometry)) {
+            ++games;
+            std::mt19937 gen;
+            Board<G> board(gen, geometry, log.mines);
+            auto states = agent::replayGame(log);
+
+            GameResult result = GameResult::Continue;
+            for (int n = 0; n < log.actions.size(); ++n) {
+                if (isTerminal(result) || states[n] != board.getState()) {
+                    ++errors;
+                }
+                result = board.act(log.actions[n]);
+            }
+            if (!isTerminal(result) || getReward(result) != log.result || log.mines.count() != geometry.mines() ||
+                std::accumulate(log.searches.begin(), log.searches.end(), 0) != log.visits.size()) {
+                ++errors;
+            }
+            for (const auto &[action, count]: log.visits) {
+                errors += count <= 0;
+            }
+        }
+        if (shard == 0) {
+            errors += getDamagedRecordErrors(name, geometry);
+        }
+        std::filesystem::remove(name);
+    }
+
+    std::cout << "game log games " << games << " errors " << errors
+              << " bytes per game " << bytes / std::max(games, 1) << std::endl;
+}
+
+int main() {
+    auto serial = run<Beginner>(16, 20, 1, 300, false);
+    auto parallel = run<Beginner>(16, 20, 4, 300, false);
+    auto buffered = run<Beginner>(16, 20, 4, 300, true);
+    std::cout << "batches equal across thread counts: " << (serial == parallel) << std::endl;
+    std::cout << "batches equal in buffers: " << (serial == buffered) << std::endl;
+
+    run<Expert>(32, 20, 4, 100, true);
+
+    testBatchOwnership<Beginner>(8, 20);
+    testLogFailure<Beginner>(8, 20);
+    testGameLog<Beginner>(8, 20, 300);
+    return 0;
+}
@@ -5,16 +5,17 @@
 
 using namespace game;
 
-void printState(const State& state) {
+template<class G>
+void printState(const State<G> &state) {
     std::cout << "┌";
-    for (int i = 0; i < WIDTH; ++i) {
+    for (int i = 0; i < state.width(); ++i) {
         std::cout << "─";
     }
     std::cout << "┐\n";
 
-    for (int i = 0; i < HEIGHT; ++i) {
+    for (int i = 0; i < state.height(); ++i) {
         std::cout << "│";
-        for (int j = 0; j < WIDTH; ++j) {
+        for (int j = 0; j < state.width(); ++j) {
             if (isOpened(state, i, j)) {
                 int mines = getMineCount(state, i, j);
                 if (mines > 0) {
@@ -32,7 +33,7 @@ void printState(const State& state) {
     }
 
     std::cout << "└";
-    for (int i = 0; i < WIDTH; ++i) {
+    for (int i = 0; i < state.width(); ++i) {
         std::cout << "─";
     }
     std::cout << "┘\n" << std::endl;
@@ -40,7 +41,7 @@ void printState(const State& state) {
 
 void interactive() {
     std::mt19937 gen;
-    Board board(gen);
+    Board<Expert> board(gen);
 
     while (true) {
         char command;
@@ -67,7 +68,7 @@ void interactive() {
 
 template<class Agent>
 bool play(std::mt19937& gen, bool verbose) {
-    Board board(gen);
+    Board<Expert> board(gen);
     Agent agent(gen);
 
     while(true) {
@@ -100,6 +101,6 @@ int tournament(int games, bool verbose) {
 
 int main() {
     // interactive();
-    std::cout << tournament<agent::TreeAgent>(100, true);
+    std::cout << tournament<agent::TreeAgent<Expert>>(100, true);
     return 0;
 }
\ No newline at end of file
@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 #include "mines.h"
 #include "agent.h"
+#include "batch.h"
 
 using namespace game;
 const static std::string mineState = "[[2 3 4 0 4 1 3 2 2]\n"
@@ -14,10 +19,10 @@ const static std::string mineState = "[[2 3 4 0 4 1 3 2 2]\n"
                                      " [0 3 0 0 0 0 0 0 0]\n"
                                      " [0 0 3 3 4 3 0 0 0]]";
 
-void prepareState(State &state) {
-    for (int i = 0; i < HEIGHT; ++i) {
-        for (int j = 0; j < WIDTH; ++j) {
-            state[i][j] = std::stoi(mineState.substr((2 * WIDTH + 3) * i + 2 * j + 2, 1));
+void prepareState(State<Beginner> &state) {
+    for (int i = 0; i < Beginner::HEIGHT; ++i) {
+        for (int j = 0; j < Beginner::WIDTH; ++j) {
+            state.set(i, j, std::stoi(mineState.substr((2 * Beginner::WIDTH + 3) * i + 2 * j + 2, 1)));
         }
     }
 }
@@ -41,7 +46,7 @@ bool getVariantValidity(const std::vector<Group> &constraints, const std::vector
     return true;
 }
 
-std::vector<game::Action> getExactActionsSlow(const game::State &state) {
+std::vector<game::Action> getExactActionsSlow(const game::State<Beginner> &state) {
     auto [constraints, coordinates] = game::getMineConstraints(state);
     auto variants = game::getMineVariants(constraints);
 
@@ -72,8 +77,511 @@ std::vector<game::Action> getExactActionsSlow(const game::State &state) {
     return actions;
 }
 
+bool getCountEquality(const VariantCount &lhs, const VariantCount &rhs) {
+    if (lhs.variants.size() != rhs.variants.size() || lhs.cellMines.size() != rhs.cellMines.size()) {
+        return false;
+    }
+    for (int i = 0; i < lhs.variants.size(); ++i) {
+        if (std::abs(lhs.variants[i] - rhs.variants[i]) > 1e-9 * rhs.variants[i]) {
+            return false;
+        }
+    }
+    for (int i = 0; i < lhs.cellMines.size(); ++i) {
+        if (std::abs(lhs.cellMines[i] - rhs.cellMines[i]) > 1e-9 * rhs.cellMines[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<int> getBackboneSlow(const std::vector<Group> &constraints, int size) {
+    auto variants = getMineVariants(constraints);
+    std::vector<int> backbone(size, -1);
+    for (int var = 0; var < size && !variants.empty(); ++var) {
+        backbone[var] = variants[0].variables[var];
+        for (const auto &variant: variants) {
+            if (variant.variables[var] != backbone[var]) {
+                backbone[var] = -1;
+            }
+        }
+    }
+    return backbone;
+}
+
+// counting has to agree with tallying the listed variants, both per component and for the whole state
+void testVariantCount(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<Expert> board(gen);
+        while (true) {
+            auto actions = agent::getExactActionsWeak(board.getState());
+            if (actions.empty()) {
+                auto possible = getPossibleActions(board.getState());
+                actions = {possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]};
+            }
+
+            bool terminal = false;
+            for (auto action: actions) {
+                terminal = terminal || isTerminal(board.act(action));
+            }
+            if (terminal) {
+                break;
+            }
+
+            for (const auto &constraint: board.getConstraints()) {
+                ++checks;
+                auto counts = countMineVariants(constraint.groups);
+                auto tally = countVariants(getMineVariants(constraint.groups),
+                                           static_cast<int>(constraint.coordinates.size()));
+                if (!getCountEquality(counts, tally)) {
+                    ++errors;
+                }
+                if (getMineBackbone(constraint.groups) !=
+                    getBackboneSlow(constraint.groups, static_cast<int>(constraint.coordinates.size()))) {
+                    ++errors;
+                }
+            }
+
+            auto listed = analyzeState(board.getState());
+            auto counted = analyzeState(board.getState(), AnalysisMode::Counts);
+            for (int i = 0; i < listed.mineProbability.size(); ++i) {
+                if (std::abs(listed.mineProbability[i] - counted.mineProbability[i]) > 1e-9) {
+                    ++errors;
+                    break;
+                }
+            }
+        }
+    }
+
+    std::cout << "variant counts checked " << checks << " errors " << errors << std::endl;
+}
+
+// cached answers have to match solving from scratch, most components survive a move unchanged
+void testComponentCache(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+    getComponentCache().clear();
+
+    for (int game = 0; game < games; ++game) {
+        Board<Expert> board(gen);
+        while (true) {
+            for (const auto &constraint: decoupleMineConstraints(getMineConstraints(board.getState()))) {
+                ++checks;
+                if (getComponentCache().getBackbone(constraint.groups) != getMineBackbone(constraint.groups)) {
+                    ++errors;
+                }
+            }
+
+            auto actions = agent::getExactActionsStrong(board.getState());
+            if (actions.empty()) {
+                auto possible = getPossibleActions(board.getState());
+                actions = {possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]};
+            }
+
+            bool terminal = false;
+            for (auto action: actions) {
+                terminal = terminal || isTerminal(board.act(action));
+            }
+            if (terminal) {
+                break;
+            }
+        }
+    }
+
+    std::cout << "component cache checked " << checks << " errors " << errors << " size "
+              << getComponentCache().size() << " hit rate " << getComponentCache().getHitRate() << std::endl;
+}
+
+// the pipeline may only return moves the strong solver finds and has to find one whenever it does
+void testSolverPipeline(std::mt19937 &gen, int games) {
+    agent::SolverPipeline solver;
+    int checks = 0;
+    int errors = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<Expert> board(gen);
+        while (true) {
+            ++checks;
+            auto actions = solver.getActions(board.getState());
+            auto strong = agent::getExactActionsStrong(board.getState());
+            if (actions.empty() != strong.empty() || solver.getTiers().size() != actions.size()) {
+                ++errors;
+            }
+            for (auto action: actions) {
+                if (std::none_of(strong.begin(), strong.end(), [action](auto other) {
+                    return action.i == other.i && action.j == other.j && action.cell == other.cell;
+                })) {
+                    ++errors;
+                }
+            }
+
+            if (actions.empty()) {
+                auto possible = getPossibleActions(board.getState());
+                actions = {possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]};
+            }
+
+            bool terminal = false;
+            for (auto action: actions) {
+                terminal = terminal || isTerminal(board.act(action));
+            }
+            if (terminal) {
+                break;
+            }
+        }
+    }
+
+    std::cout << "solver pipeline checked " << checks << " errors " << errors << std::endl;
+    const char *names[] = {"saturation", "subset", "elimination", "enumeration"};
+    const auto &stats = solver.getStats();
+    for (int tier = 0; tier < agent::SolverStats::TIERS; ++tier) {
+        std::cout << names[tier] << " components " << stats.components[tier] << " settled " << stats.settled[tier]
+                  << " actions " << stats.actions[tier] << " seconds " << stats.seconds[tier] << std::endl;
+    }
+}
+
+// sampled layouts have to fit the state and put mines in its cells as often as the analysis expects
+void testSampleLayouts(std::mt19937 &gen, int games, int samples) {
+    Expert geometry;
+    int cells = geometry.cells();
+    int checks = 0;
+    int errors = 0;
+    double deviation = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<Expert> board(gen);
+        for (int move = 0; move < 4; ++move) {
+            auto possible = getPossibleActions(board.getState());
+            auto action = possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)];
+            if (isTerminal(board.act(action))) {
+                break;
+            }
+        }
+        const auto &state = board.getState();
+        if (isTerminal(getStateResult(state))) {
+            continue;
+        }
+
+        auto analysis = analyzeState(state);
+        std::vector<uint8_t> layouts(samples * cells);
+        sampleLayouts(analysis, samples, gen, layouts.data());
+
+        std::vector<int> frequency(cells);
+        for (int k = 0; k < samples; ++k) {
+            const uint8_t *layout = layouts.data() + k * cells;
+            ++checks;
+            int mines = 0;
+            bool valid = true;
+            for (int i = 0; i < geometry.height(); ++i) {
+                for (int j = 0; j < geometry.width(); ++j) {
+                    mines += layout[i * geometry.width() + j];
+                    frequency[i * geometry.width() + j] += layout[i * geometry.width() + j];
+                    if (isOpened(state, i, j)) {
+                        int around = 0;
+                        for (int n = std::max(i - 1, 0); n <= std::min(i + 1, geometry.height() - 1); ++n) {
+                            for (int m = std::max(j - 1, 0); m <= std::min(j + 1, geometry.width() - 1); ++m) {
+                                around += layout[n * geometry.width() + m];
+                            }
+                        }
+                        valid = valid && !layout[i * geometry.width() + j] && around == getMineCount(state, i, j);
+                    }
+                }
+            }
+            if (!valid || mines != geometry.mines()) {
+                ++errors;
+            }
+        }
+
+        for (int i = 0; i < geometry.height(); ++i) {
+            for (int j = 0; j < geometry.width(); ++j) {
+                double expected = analysis.mineProbability[i * Expert::WIDTH + j];
+                double sampled = frequency[i * geometry.width() + j] / static_cast<double>(samples);
+                deviation = std::max(deviation, std::abs(sampled - expected));
+            }
+        }
+    }
+
+    std::cout << "sampled layouts checked " << checks << " errors " << errors << " largest deviation " << deviation
+              << std::endl;
+}
+
+// the tables have to agree with the gamma function, and scores with the ratios of binomials they stand for
+void testLogBinomial() {
+    int checks = 0;
+    int errors = 0;
+
+    int size = static_cast<int>(getLogFactorials().size()) - 1;
+    for (int n = 0; n <= size; n += 7) {
+        for (int k = 0; k <= n; ++k) {
+            ++checks;
+            double expected = std::lgamma(n + 1) - std::lgamma(k + 1) - std::lgamma(n - k + 1);
+            if (std::abs(getLogBinomial(n, k) - expected) > 1e-9 * std::max(1.0, expected)) {
+                ++errors;
+            }
+        }
+        if (getLogBinomial(n, -1) != -std::numeric_limits<double>::infinity() ||
+            getLogBinomial(n, n + 1) != -std::numeric_limits<double>::infinity()) {
+            ++errors;
+        }
+    }
+
+    std::vector<int> leftMines;
+    for (int mines = -2; mines <= 102; ++mines) {
+        leftMines.push_back(mines);
+    }
+    auto score = getPositionScore(leftMines, 100);
+    for (int k = 0; k < leftMines.size(); ++k) {
+        ++checks;
+        double expected = std::exp(getLogBinomial(100, leftMines[k]) - getLogBinomial(100, 50));
+        if (std::abs(score[k] - expected) > 1e-12) {
+            ++errors;
+        }
+    }
+
+    std::cout << "log binomials checked " << checks << " errors " << errors << std::endl;
+}
+
+// probabilities from convolving the components have to match weighing every combination of their groups
+void testComponentConvolution(std::mt19937 &gen, int games) {
+    int checks = 0;
+    int errors = 0;
+    int skipped = 0;
+
+    for (int game = 0; game < games; ++game) {
+        Board<Expert> board(gen);
+        while (true) {
+            auto actions = agent::getExactActionsWeak(board.getState());
+            if (actions.empty()) {
+                auto possible = getPossibleActions(board.getState());
+                actions = {possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]};
+            }
+
+            bool terminal = false;
+            for (auto action: actions) {
+                terminal = terminal || isTerminal(board.act(action));
+            }
+            if (terminal) {
+                break;
+            }
+
+            const auto &state = board.getState();
+            auto analysis = analyzeState(state, AnalysisMode::Counts);
+            int size = static_cast<int>(analysis.condensedVariants.size());
+            double combinations = 1;
+            for (const auto &variantGroups: analysis.condensedVariants) {
+                combinations *= static_cast<double>(variantGroups.size());
+            }
+            if (combinations > 1e5) {
+                ++skipped;
+                continue;
+            }
+            ++checks;
+
+            int leftSpace = static_cast<int>(analysis.interior.size());
+            int leftMines = state.geometry().mines() - state.flagged().count();
+            std::vector<int> index(size);
+            std::vector<double> logWeights;
+            std::vector<std::vector<int>> indices;
+            while (true) {
+                int mines = 0;
+                double logWeight = 0;
+                for (int n = 0; n < size; ++n) {
+                    mines += analysis.condensedVariants[n][index[n]].mines;
+                    logWeight += std::log(analysis.condensedVariants[n][index[n]].count);
+                }
+                if (mines <= leftMines && leftMines - mines <= leftSpace) {
+                    logWeights.push_back(logWeight + getLogBinomial(leftSpace, leftMines - mines));
+                    indices.push_back(index);
+                }
+
+                int pivot = 0;
+                while (pivot < size && ++index[pivot] == analysis.condensedVariants[pivot].size()) {
+                    index[pivot++] = 0;
+                }
+                if (pivot == size) {
+                    break;
+                }
+            }
+
+            double largest = *std::max_element(logWeights.begin(), logWeights.end());
+            double sum = 0;
+            for (double &w: logWeights) {
+                w = std::exp(w - largest);
+                sum += w;
+            }
+
+            std::vector<double> expected(Expert::HEIGHT * Expert::WIDTH);
+            double interiorMines = 0;
+            for (int k = 0; k < indices.size(); ++k) {
+                double probability = logWeights[k] / sum;
+                int mines = 0;
+                for (int n = 0; n < size; ++n) {
+                    const auto &group = analysis.condensedVariants[n][indices[k][n]];
+                    const auto &coordinates = analysis.coordinates[n];
+                    int cells = static_cast<int>(coordinates.size());
+                    mines += group.mines;
+                    for (int c = 0; c < cells; ++c) {
+                        auto [i, j] = coordinates[c];
+                        expected[i * Expert::WIDTH + j] +=
+                                probability * analysis.counts[n].cellMines[group.mines * cells + c] / group.count;
+                    }
+                }
+                interiorMines += probability * (leftMines - mines);
+            }
+            for (auto [i, j]: analysis.interior) {
+                expected[i * Expert::WIDTH + j] = interiorMines / leftSpace;
+            }
+
+            bool equal = true;
+            state.unknown().forEach([&](int i, int j) {
+                equal = equal && std::abs(expected[i * Expert::WIDTH + j] -
+                                          analysis.mineProbability[i * Expert::WIDTH + j]) < 1e-9;
+            });
+            if (!equal) {
+                ++errors;
+            }
+        }
+    }
+
+    std::cout << "component convolution checked " << checks << " errors " << errors << " skipped " << skipped
+              << std::endl;
+}
+
+// a batch analysed on a pool has to give what the analysis of its states one by one gives
+// a corner 3 with two unknown neighbours, and more flags than the board has mines
+std::vector<State<Beginner>> getInconsistentStates() {
+    State<Beginner> corner;
+    corner.set(0, 0, EMPTY + 3);
+    corner.set(1, 1, EMPTY + 1);
+
+    State<Beginner> flags;
+    for (int k = 0; k <= Beginner::mines(); ++k) {
+        flags.set(k / Beginner::width(), k % Beginner::width(), FLAG);
+    }
+    return {corner, flags};
+}
+
+// states no layout agrees with are refused, in both modes and in batches
+void testInconsistentState() {
+    int checks = 0;
+    int errors = 0;
+    for (const auto &state: getInconsistentStates()) {
+        for (auto mode: {AnalysisMode::Variants, AnalysisMode::Counts}) {
+            ++checks;
+            try {
+                analyzeState(state, mode);
+                ++errors;
+            } catch (const std::invalid_argument &) {
+            }
+        }
+    }
+
+    // in a batch they get a row of NaNs between the rows of states that are fine
+    State<Beginner> fine;
+    fine.set(4, 4, EMPTY + 1);
+    std::vector<State<Beginner>> states = {fine};
+    for (const auto &state: getInconsistentStates()) {
+        states.push_back(state);
+        states.push_back(fine);
+    }
+    int cells = Beginner::cells();
+    int statCount = static_cast<int>(agent::BatchStat::Count);
+    std::vector<uint8_t> batch;
+    for (const auto &state: states) {
+        for (int i = 0; i < Beginner::height(); ++i) {
+            batch.insert(batch.end(), state[i].begin(), state[i].begin() + Beginner::width());
+        }
+    }
+    int count = static_cast<int>(states.size());
+    std::vector<int8_t> actions(count * cells);
+    std::vector<float> probability(count * cells);
+    std::vector<int32_t> stats(count * statCount);
+
+    agent::ThreadPool pool(2);
+    agent::analyzeBatch(batch.data(), count, Beginner(), pool, actions.data(), probability.data(), stats.data());
+    for (int k = 0; k < count; ++k) {
+        ++checks;
+        bool inconsistent = k % 2 == 1;
+        if (std::isnan(probability[k * cells]) != inconsistent || (stats[k * statCount] == -1) != inconsistent) {
+            ++errors;
+        }
+    }
+
+    ++checks;
+    batch[cells + 40] = BOMB + 1;
+    try {
+        agent::analyzeBatch(batch.data(), count, Beginner(), pool, actions.data(), probability.data(), stats.data());
+        ++errors;
+    } catch (const std::invalid_argument &) {
+    }
+
+    std::cout << "inconsistent states checked " << checks << " errors " << errors << std::endl;
+}
+
+void testAnalyzeBatch(std::mt19937 &gen, int games) {
+    Expert geometry;
+    int cells = geometry.cells();
+    int statCount = static_cast<int>(agent::BatchStat::Count);
+
+    std::vector<State<Expert>> states;
+    std::vector<uint8_t> batch;
+    for (int game = 0; game < games; ++game) {
+        Board<Expert> board(gen);
+        while (true) {
+            const auto &state = board.getState();
+            states.push_back(state);
+            for (int i = 0; i < geometry.height(); ++i) {
+                batch.insert(batch.end(), state[i].begin(), state[i].begin() + geometry.width());
+            }
+
+            auto possible = getPossibleActions(state);
+            auto action = possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)];
+            if (isTerminal(board.act(action))) {
+                break;
+            }
+        }
+    }
+
+    int count = static_cast<int>(states.size());
+    std::vector<int8_t> actions(count * cells);
+    std::vector<float> probability(count * cells);
+    std::vector<int32_t> stats(count * statCount);
+
+    agent::ThreadPool pool(4);
+    auto start = std::chrono::steady_clock::now();
+    agent::analyzeBatch(batch.data(), count, geometry, pool, actions.data(), probability.data(), stats.data());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int errors = 0;
+    for (int k = 0; k < count; ++k) {
+        std::vector<int8_t> expected(cells);
+        for (auto action: agent::getExactActionsStrong(states[k])) {
+            expected[action.i * geometry.width() + action.j] = action.cell == Cell::Open ? 1 : -1;
+        }
+        auto analysis = analyzeState(states[k], AnalysisMode::Counts);
+
+        for (int i = 0; i < geometry.height(); ++i) {
+            for (int j = 0; j < geometry.width(); ++j) {
+                int cell = k * cells + i * geometry.width() + j;
+                if (actions[cell] != expected[i * geometry.width() + j] ||
+                    probability[cell] != static_cast<float>(analysis.mineProbability[i * Expert::WIDTH + j])) {
+                    ++errors;
+                }
+            }
+        }
+        if (stats[k * statCount + static_cast<int>(agent::BatchStat::Components)] != analysis.coordinates.size() ||
+            stats[k * statCount + static_cast<int>(agent::BatchStat::FrontierCells)] != states[k].frontier().count()) {
+            ++errors;
+        }
+    }
+
+    std::cout << "batch analysis checked " << count << " states errors " << errors << " states per second "
+              << count / seconds << std::endl;
+}
+
 int main() {
-    State state;
+    State<Beginner> state;
     prepareState(state);
 
     auto constraint = getMineConstraints(state);
@@ -110,5 +618,15 @@ int main() {
     }
 
     auto analysis = analyzeState(state);
+
+    std::mt19937 gen(42);
+    testVariantCount(gen, 20);
+    testComponentCache(gen, 20);
+    testSolverPipeline(gen, 20);
+    testSampleLayouts(gen, 20, 20000);
+    testLogBinomial();
+    testComponentConvolution(gen, 20);
+    testAnalyzeBatch(gen, 20);
+    testInconsistentState();
     return 0;
 }
\ No newline at end of file
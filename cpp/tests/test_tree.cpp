@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <thread>
+
+#include "agent.h"
+
+using namespace game;
+
+template<class G>
+State<G> openGame(std::mt19937 &gen) {
+    Board<G> board(gen);
+    board.act(Action{G::height() / 2, G::width() / 2, Cell::Open});
+    while (true) {
+        auto actions = agent::getExactActionsStrong(board.getState());
+        if (actions.empty()) {
+            return board.getState();
+        }
+        for (auto action: actions) {
+            board.act(action);
+        }
+    }
+}
+
+template<class G>
+std::pair<std::vector<double>, double> evaluate(const PerfectBoard<G> &board, std::mt19937 &gen) {
+    size_t actionSpace = getPossibleActions(board.getState()).size();
+    double value = getReward(agent::RandomAgent<G>(gen).rollout(board));
+    return {std::vector<double>(actionSpace, 1.0 / static_cast<double>(actionSpace)), value};
+}
+
+// every virtual loss has to be taken back, so the root ends up with exactly one visit per descent
+template<class G>
+typename tree::Tree<G>::SearchStats testSearch(std::mt19937 &gen, const State<G> &state, int iterations, int threads) {
+    tree::Tree<G> tree(gen);
+    size_t actionSpace = getPossibleActions(state).size();
+    tree.moveto(state, std::vector<double>(actionSpace, 1.0 / static_cast<double>(actionSpace)));
+
+    auto stats = tree.search(iterations, threads, evaluate<G>);
+    auto nVisits = tree.getRootVisits();
+    int visits = std::accumulate(nVisits.begin(), nVisits.end(), 0);
+
+    std::cout << "threads " << stats.threads << " iterations " << stats.iterations << " descents " << stats.descents
+              << " root visits " << visits << " collisions " << tree.getCollisions()
+              << " errors " << (visits != stats.descents) << std::endl;
+    return stats;
+}
+
+// moving to a child keeps its statistics and drops the rest of the tree
+template<class G>
+void testMoveto(std::mt19937 &gen, const State<G> &state, int iterations) {
+    tree::Tree<G> tree(gen);
+    size_t actionSpace = getPossibleActions(state).size();
+    tree.moveto(state, std::vector<double>(actionSpace, 1.0 / static_cast<double>(actionSpace)));
+    tree.search(iterations, 1, evaluate<G>);
+    int before = tree.size();
+
+    int errors = 0;
+    int moves = 0;
+    // a layout where the first sampled action goes on
+    auto analysis = analyzeState(state);
+    auto action = tree.sampleAction();
+    std::unique_ptr<PerfectBoard<G>> board;
+    do {
+        board = std::make_unique<PerfectBoard<G>>(gen, analysis);
+    } while (isTerminal(board->act(action)));
+
+    do {
+        auto child = board->getState();
+        actionSpace = getPossibleActions(child).size();
+        tree.moveto(child, std::vector<double>(actionSpace, 1.0 / static_cast<double>(actionSpace)));
+
+        auto nVisits = tree.getRootVisits();
+        int visits = std::accumulate(nVisits.begin(), nVisits.end(), 0);
+        auto stats = tree.search(iterations / 10, 1, evaluate<G>);
+        nVisits = tree.getRootVisits();
+        errors += std::accumulate(nVisits.begin(), nVisits.end(), 0) != visits + stats.descents;
+        ++moves;
+    } while (!isTerminal(board->act(tree.sampleAction())));
+
+    std::cout << "moveto nodes before " << before << " moves " << moves << " nodes after " << tree.size()
+              << " errors " << errors << std::endl;
+}
+
+// the merged root of an ensemble counts every descent of every tree, and all trees share the root actions
+template<class G>
+void testEnsemble(std::mt19937 &gen, const State<G> &state, int iterations, int trees) {
+    tree::Ensemble<G> ensemble(gen, trees);
+    size_t actionSpace = getPossibleActions(state).size();
+    ensemble.moveto(state, std::vector<double>(actionSpace, 1.0 / static_cast<double>(actionSpace)));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    std::vector<int> descents(trees);
+    for (int k = 0; k < trees; ++k) {
+        workers.emplace_back([&, k]() {
+            descents[k] = ensemble[k].search(iterations, 1, evaluate<G>).descents;
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto nVisits = ensemble.getRootVisits();
+    int visits = std::accumulate(nVisits.begin(), nVisits.end(), 0);
+    int errors = visits != std::accumulate(descents.begin(), descents.end(), 0);
+    auto actions = ensemble[0].getRootActions();
+    auto same = [](const Action &a, const Action &b) {
+        return a.i == b.i && a.j == b.j && a.cell == b.cell;
+    };
+    for (int k = 1; k < trees; ++k) {
+        auto other = ensemble[k].getRootActions();
+        errors += !std::equal(actions.begin(), actions.end(), other.begin(), other.end(), same);
+    }
+    auto action = ensemble.sampleAction();
+    errors += std::none_of(actions.begin(), actions.end(), [&](const Action &a) {
+        return same(a, action);
+    });
+
+    std::cout << "ensemble trees " << trees << " iterations " << trees * iterations << " root visits " << visits
+              << " seconds " << seconds << " errors " << errors << std::endl;
+}
+
+int main() {
+    std::mt19937 gen(42);
+    auto state = openGame<Expert>(gen);
+
+    int threads = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+    auto serial = testSearch(gen, state, 2000, 1);
+    auto parallel = testSearch(gen, state, 2000, threads);
+
+    std::cout << "speedup with " << threads << " threads: "
+              << (serial.seconds / serial.iterations) / (parallel.seconds / parallel.iterations) << std::endl;
+
+    testEnsemble(gen, state, 2000 / threads, threads);
+    testMoveto(gen, state, 2000);
+    return 0;
+}
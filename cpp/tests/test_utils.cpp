@@ -1,4 +1,9 @@
+#include <chrono>
 #include <iostream>
+#include <set>
+
+#include "agent.h"
+#include "elimination.h"
 #include "utils.h"
 
 template<class T>
@@ -32,7 +37,113 @@ void testGaussianElimination() {
     printSystem(&mat3[0][0], vec3, 3, 3);
 }
 
+std::set<std::pair<int, bool>> getForcedTemplate(const game::Constraint &component) {
+    int rows = static_cast<int>(component.groups.size());
+    int columns = static_cast<int>(component.coordinates.size());
+    std::vector<int> matrix(rows * columns);
+    std::vector<int> vector(rows);
+    for (int i = 0; i < rows; ++i) {
+        for (int index: component.groups[i].indices) {
+            matrix[i * columns + index] = 1;
+        }
+        vector[i] = component.groups[i].mines;
+    }
+
+    makeGaussianElimination(matrix.data(), vector.data(), rows, columns);
+
+    std::set<std::pair<int, bool>> forced;
+    for (int i = rows - 1; i >= 0; --i) {
+        int lowerBound = 0;
+        int upperBound = 0;
+        for (int j = 0; j < columns; ++j) {
+            lowerBound += std::min(matrix[i * columns + j], 0);
+            upperBound += std::max(matrix[i * columns + j], 0);
+        }
+        for (int j = 0; j < columns; ++j) {
+            if (matrix[i * columns + j] && (vector[i] == upperBound || vector[i] == lowerBound)) {
+                forced.emplace(j, (matrix[i * columns + j] > 0) == (vector[i] == upperBound));
+            }
+        }
+    }
+    return forced;
+}
+
+// the packed kernel against the template on components of real games, both in result and in time
+void testEliminationKernel(std::mt19937 &gen, int games) {
+    std::vector<game::Constraint> components;
+    for (int game = 0; game < games; ++game) {
+        game::Board<game::Expert> board(gen);
+        while (true) {
+            for (const auto &component: board.getConstraints()) {
+                components.push_back(component);
+            }
+
+            auto actions = agent::getExactActionsStrong(board.getState());
+            if (actions.empty()) {
+                auto possible = game::getPossibleActions(board.getState());
+                actions = {possible[std::uniform_int_distribution<>(0, static_cast<int>(possible.size()) - 1)(gen)]};
+            }
+
+            bool terminal = false;
+            for (auto action: actions) {
+                terminal = terminal || game::isTerminal(board.act(action));
+            }
+            if (terminal) {
+                break;
+            }
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::set<std::pair<int, bool>>> expected;
+    for (const auto &component: components) {
+        expected.push_back(getForcedTemplate(component));
+    }
+    double templateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    agent::EliminationWorkspace workspace;
+    std::vector<std::vector<std::pair<int, bool>>> forced(components.size());
+    for (int n = 0; n < components.size(); ++n) {
+        const auto &component = components[n];
+        workspace.reset(static_cast<int>(component.groups.size()), static_cast<int>(component.coordinates.size()));
+        for (int i = 0; i < component.groups.size(); ++i) {
+            for (int index: component.groups[i].indices) {
+                workspace.set(i, index, 1);
+            }
+            workspace.setValue(i, component.groups[i].mines);
+        }
+        workspace.eliminate();
+        workspace.getForced(forced[n]);
+    }
+    double kernelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // pivots are chosen differently, so both may force different cells, but never a wrong one
+    int errors = 0;
+    size_t templateForced = 0;
+    size_t kernelForced = 0;
+    for (int n = 0; n < components.size(); ++n) {
+        auto backbone = game::getMineBackbone(components[n].groups);
+        std::set<std::pair<int, bool>> cells(forced[n].begin(), forced[n].end());
+        for (auto [index, mine]: cells) {
+            errors += backbone[index] != mine;
+        }
+        for (auto [index, mine]: expected[n]) {
+            errors += backbone[index] != mine;
+        }
+        templateForced += expected[n].size();
+        kernelForced += cells.size();
+    }
+
+    std::cout << "elimination components " << components.size() << " errors " << errors
+              << " template forced " << templateForced << " in " << templateSeconds << "s"
+              << " kernel forced " << kernelForced << " in " << kernelSeconds << "s" << std::endl;
+}
+
 int main() {
     testGaussianElimination();
+
+    std::mt19937 gen(42);
+    testEliminationKernel(gen, 50);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+import glob
+import os
+
+import numpy as np
+
+# record layout written by agent::GameWriter, see gamelog.h
+MAGIC = 0x314c474d
+HEADER = np.dtype([("magic", "<u4"), ("size", "<u4"), ("height", "<u2"), ("width", "<u2"), ("mines", "<u2"),
+                   ("actions", "<u2"), ("visits", "<u4"), ("result", "<f4"), ("reserved", "<u4", 2)])
+
+
+def align(size):
+    return (size + 3) & ~3
+
+
+# a game of a mapped shard, its arrays are views of the file
+class Game:
+    def __init__(self, data, offset):
+        header = data[offset:offset + HEADER.itemsize].view(HEADER)[0]
+        if header["magic"] != MAGIC:
+            raise ValueError("damaged game record")
+
+        self.size = int(header["size"])
+        self.height = int(header["height"])
+        self.width = int(header["width"])
+        self.result = float(header["result"])
+        actions = int(header["actions"])
+        visits = int(header["visits"])
+
+        mask_bytes = align((self.height * self.width + 7) // 8)
+        if self.size != HEADER.itemsize + mask_bytes + 2 * align(2 * actions) + 4 * visits \
+                or offset + self.size > len(data):
+            raise ValueError("damaged game record")
+
+        start = offset + HEADER.itemsize
+        self.packed_mines = data[start:start + mask_bytes]
+        start += mask_bytes
+        self.deltas = data[start:start + 2 * actions].view("<u2")
+        start += align(2 * actions)
+        self.searches = data[start:start + 2 * actions].view("<u2")
+        start += align(2 * actions)
+        self.visits = data[start:start + 4 * visits].view("<u2").reshape(visits, 2)
+
+    def mines(self):
+        cells = self.height * self.width
+        return np.unpackbits(self.packed_mines, bitorder="little")[:cells].reshape(self.height, self.width) > 0
+
+    # action ids, cell index times 2 plus 1 for a flag
+    def actions(self):
+        return np.cumsum(self.deltas, dtype=np.uint16)
+
+    # root visit distributions over the cells, rows of actions the solver found are zero
+    def policy_targets(self):
+        actions = len(self.deltas)
+        targets = np.zeros((actions, self.height * self.width), dtype=np.float32)
+        rows = np.repeat(np.arange(actions), self.searches)
+        np.add.at(targets, (rows, self.visits[:, 0] >> 1), self.visits[:, 1])
+
+        sums = targets.sum(axis=1, keepdims=True)
+        np.divide(targets, sums, out=targets, where=sums > 0)
+        return targets.reshape(actions, self.height, self.width)
+
+    # states the actions were played in
+    def states(self):
+        import engine
+        return engine.replay_game(self.mines(), self.actions())
+
+
+def read_games(path):
+    # a writer opens its first shard before any game is done, numpy cannot map it while it is empty
+    if os.path.getsize(path) == 0:
+        return
+    data = np.memmap(path, dtype=np.uint8, mode="r")
+    offset = 0
+    while offset < len(data):
+        game = Game(data, offset)
+        yield game
+        offset += game.size
+
+
+def read_shards(prefix):
+    for path in sorted(glob.glob(glob.escape(prefix) + "-[0-9][0-9][0-9][0-9][0-9].bin")):
+        yield from read_games(path)
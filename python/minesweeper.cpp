@@ -1,29 +1,32 @@
+#include <cstring>
+
 #include "minesweeper.h"
 
 namespace py = pybind11;
 using namespace game;
 
-State readState(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> state) {
-    State s;
+template<class G>
+State<G> readState(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> state, G geometry) {
+    State<G> s(geometry);
     uint8_t *sptr = static_cast<uint8_t *>(state.request().ptr);
-    for (int i = 0; i < HEIGHT; ++i) {
-        for (int j = 0; j < WIDTH; ++j) {
-            s[i][j] = sptr[i * WIDTH + j];
+    for (int i = 0; i < s.height(); ++i) {
+        for (int j = 0; j < s.width(); ++j) {
+            s.set(i, j, sptr[i * s.width() + j]);
         }
     }
     return s;
 }
 
-void writeStateToPtr(const State &state, uint8_t *ptr) {
-    for (int i = 0; i < HEIGHT; ++i) {
-        for (int j = 0; j < WIDTH; ++j) {
-            ptr[i * WIDTH + j] = state[i][j];
-        }
+template<class G>
+void writeStateToPtr(const State<G> &state, uint8_t *ptr) {
+    for (int i = 0; i < state.height(); ++i) {
+        std::memcpy(ptr + i * state.width(), state[i].data(), state.width());
     }
 }
 
-py::array_t<uint8_t> writeState(const State &state) {
-    auto result = py::array_t<uint8_t>({HEIGHT, WIDTH});
+template<class G>
+py::array_t<uint8_t> writeState(const State<G> &state) {
+    auto result = py::array_t<uint8_t>({state.height(), state.width()});
     writeStateToPtr(state, static_cast<uint8_t *>(result.request().ptr));
     return result;
 }
@@ -54,30 +57,36 @@ py::array_t<int> writeActions(const std::vector<Action> &actions) {
     return result;
 }
 
+template<class G>
 std::vector<double>
-readPolicy(const State &state, float *ptr) {
-    auto actions = getPossibleActions(state);
+readPolicy(const State<G> &state, float *ptr) {
+    // in the order of getPossibleActions
+    auto unknown = state.unknown();
     std::vector<double> p;
+    p.reserve(unknown.count());
 
-    for (auto action: actions) {
-        p.push_back(ptr[action.i * WIDTH + action.j]);
-    }
+    unknown.forEach([&state, &p, ptr](int i, int j) {
+        p.push_back(ptr[i * state.width() + j]);
+    });
 
     return p;
 }
 
-void PyTreeAgent::loadState(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> state,
-                            py::array_t<float, py::array::c_style | py::array::forcecast> policy) {
-    auto s = readState(state);
+template<class G>
+void PyTreeAgent<G>::loadState(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> state,
+                               py::array_t<float, py::array::c_style | py::array::forcecast> policy) {
+    auto s = readState(state, geometry_);
     auto p = readPolicy(s, static_cast<float *>(policy.request().ptr));
     agent_.loadState(std::move(s), std::move(p));
 }
 
-py::array_t<int> PyTreeAgent::getActions(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> state) {
-    return writeActions(agent_.getActions(readState(state)));
+template<class G>
+py::array_t<int> PyTreeAgent<G>::getActions(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> state) {
+    return writeActions(agent_.getActions(readState(state, geometry_)));
 }
 
-std::optional<py::array_t<uint8_t>> PyTreeAgent::explore() {
+template<class G>
+std::optional<py::array_t<uint8_t>> PyTreeAgent<G>::explore() {
     auto state = agent_.explore();
     if (!state.has_value()) {
         return std::nullopt;
@@ -85,109 +94,250 @@ std::optional<py::array_t<uint8_t>> PyTreeAgent::explore() {
     return writeState(state.value());
 }
 
-void PyTreeAgent::update(py::array_t<float, py::array::c_style | py::array::forcecast> policy, float value) {
+template<class G>
+void PyTreeAgent<G>::update(py::array_t<float, py::array::c_style | py::array::forcecast> policy, float value) {
     agent_.update(readPolicy(agent_.getState(), static_cast<float *>(policy.request().ptr)), value);
 }
 
-PyTreeManager::PyTreeManager(int batchSize, int treeIter) : batchSize_(batchSize), treeIter_(treeIter) {
-    for (int i = 0; i < batchSize; ++i) {
-        initializeAgent(i);
+template<class G>
+PyTreeManager<G>::PyTreeManager(int batchSize, int treeIter, int threads, G geometry)
+        : geometry_(geometry),
+          selfPlay_(batchSize, treeIter, threads > 0 ? threads : std::max(1U, std::thread::hardware_concurrency()),
+                    geometry) {
+}
+
+template<class G>
+template<class T>
+py::array_t<T> PyTreeManager<G>::makeView(T *ptr, std::vector<py::ssize_t> shape) {
+    // an array with a base does not copy the data, the base is the python object of this manager
+    return py::array_t<T>(std::move(shape), ptr, py::cast(this));
+}
+
+template<class G>
+py::array_t<uint8_t> PyTreeManager<G>::getBatch() {
+    {
+        // the workers keep going while python runs, the gil is only needed to hand the view over
+        py::gil_scoped_release release;
+        half_ = selfPlay_.getBatch();
     }
+    return makeView(const_cast<uint8_t *>(selfPlay_.getStates(half_)),
+                    {selfPlay_.getBatchSize(), geometry_.height(), geometry_.width()});
 }
 
-py::array_t<uint8_t> PyTreeManager::getBatch() {
-    py::array_t<uint8_t> result({batchSize_, HEIGHT, WIDTH});
-    auto ptr = static_cast<uint8_t *>(result.request().ptr);
+template<class G>
+py::array_t<uint8_t> PyTreeManager<G>::getMasks() {
+    return makeView(const_cast<uint8_t *>(selfPlay_.getMasks(half_)),
+                    {selfPlay_.getBatchSize(), geometry_.height(), geometry_.width()});
+}
 
-    for (int i = 0; i < batchSize_; ++i) {
-        while (i == states_.size()) {
-            if (free_.empty()) {
-                initializeAgent(agents_.size());
-            } else {
-                int free = free_.front();
-                free_.pop_front();
-
-                if (!(agents_[free].getIter().has_value() && agents_[free].getIter().value() < treeIter_) &&
-                    play(free)) {
-                    initializeAgent(free);
-                } else {
-                    auto state = agents_[free].explore();
-                    if (state.has_value()) {
-                        states_.emplace_back(std::move(state.value()));
-                    }
-                }
-            }
-        }
-        writeStateToPtr(states_[i], ptr + i * HEIGHT * WIDTH);
+template<class G>
+py::array_t<float> PyTreeManager<G>::getPolicy() {
+    return makeView(selfPlay_.getPolicy(half_), {selfPlay_.getBatchSize(), geometry_.height(), geometry_.width()});
+}
+
+template<class G>
+py::array_t<float> PyTreeManager<G>::getValues() {
+    return makeView(selfPlay_.getValues(half_), {selfPlay_.getBatchSize()});
+}
+
+template<class G>
+void PyTreeManager<G>::loadBatch(py::array_t<float, py::array::c_style | py::array::forcecast> policy,
+                                 py::array_t<float, py::array::c_style | py::array::forcecast> values) {
+    int batchSize = selfPlay_.getBatchSize();
+    if (policy.size() != batchSize * geometry_.cells() || values.size() != batchSize) {
+        throw std::invalid_argument("policy and values must match the batch");
     }
+    auto pptr = static_cast<const float *>(policy.request().ptr);
+    auto vptr = static_cast<const float *>(values.request().ptr);
 
-    return result;
+    py::gil_scoped_release release;
+    selfPlay_.loadBatch(pptr, vptr);
 }
 
-void PyTreeManager::loadBatch(py::array_t<float, py::array::c_style | py::array::forcecast> policy,
-                              py::array_t<float, py::array::c_style | py::array::forcecast> values) {
-    float *pptr = static_cast<float *>(policy.request().ptr);
-    float *vptr = static_cast<float *>(values.request().ptr);
+template<class G>
+void PyTreeManager<G>::loadBuffers() {
+    py::gil_scoped_release release;
+    selfPlay_.loadBatch();
+}
 
-    for (int i = 0; i < batchSize_; ++i) {
-        auto state = std::move(states_.front());
-        auto job = std::move(jobs_.front());
-        states_.pop_front();
-        jobs_.pop_front();
+template<class G>
+void PyTreeManager<G>::setLog(const std::string &prefix, int gamesPerShard) {
+    selfPlay_.setLog(prefix, gamesPerShard);
+}
 
-        auto ptr = pptr + i * HEIGHT * WIDTH;
-        if (job.task == Task::Initialize) {
-            agents_[job.index].loadState(state, readPolicy(state, ptr));
-        } else {
-            agents_[job.index].update(readPolicy(state, ptr), vptr[i]);
+template<class G>
+int PyTreeManager<G>::getFinishedGames() {
+    return selfPlay_.getFinishedGames();
+}
+
+py::array_t<uint8_t> replayGame(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> mines,
+                                py::array_t<uint16_t, py::array::c_style | py::array::forcecast> actions) {
+    if (mines.ndim() != 2) {
+        throw std::invalid_argument("mines must be a height x width array");
+    }
+    if (actions.ndim() != 1) {
+        throw std::invalid_argument("actions must be a one dimensional array");
+    }
+    int height = static_cast<int>(mines.shape(0));
+    int width = static_cast<int>(mines.shape(1));
+    // rejects a board the storage has no room for before any cell is written
+    Custom(height, width, 0);
+    auto mptr = static_cast<const uint8_t *>(mines.request().ptr);
+    auto aptr = static_cast<const uint16_t *>(actions.request().ptr);
+    for (int n = 0; n < actions.size(); ++n) {
+        if (aptr[n] >= 2 * height * width) {
+            throw std::invalid_argument("action id outside of the board");
         }
+    }
 
-        free_.push_back(job.index);
+    agent::GameLog<Custom> log;
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+            if (mptr[i * width + j]) {
+                log.mines.set(i, j);
+            }
+        }
+    }
+    log.geometry = Custom(height, width, log.mines.count());
+    for (int n = 0; n < actions.size(); ++n) {
+        log.actions.push_back(game::unpackAction(aptr[n], width));
     }
-}
 
-void PyTreeManager::initializeAgent(int index) {
-    while (agents_.size() <= index) {
-        agents_.emplace_back(gen_);
-        boards_.emplace_back(gen_);
+    auto states = agent::replayGame(log);
+    py::array_t<uint8_t> result({static_cast<int>(states.size()), height, width});
+    auto ptr = static_cast<uint8_t *>(result.request().ptr);
+    for (int n = 0; n < states.size(); ++n) {
+        writeStateToPtr(states[n], ptr + n * height * width);
     }
+    return result;
+}
 
-    agents_[index] = agent::TreeAgent(gen_);
-    boards_[index] = LoggingBoard(gen_);
+// kept between calls, replaced when a call asks for another number of threads. Callers hold the gil
+std::shared_ptr<agent::ThreadPool> getAnalysisPool(int threads) {
+    static std::shared_ptr<agent::ThreadPool> pool;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::max(1U, std::thread::hardware_concurrency()));
+    }
+    if (!pool || pool->size() != threads) {
+        pool = std::make_shared<agent::ThreadPool>(threads);
+    }
+    return pool;
+}
 
-    jobs_.emplace_back(Job{index, Task::Initialize});
-    states_.emplace_back(boards_[index].getState());
+template<class G>
+py::tuple analyzeGeometryBatch(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> states, G geometry,
+                       int threads) {
+    int count = static_cast<int>(states.shape(0));
+    py::array_t<int8_t> actions({count, geometry.height(), geometry.width()});
+    py::array_t<float> probability({count, geometry.height(), geometry.width()});
+    py::array_t<int32_t> stats({count, static_cast<int>(agent::BatchStat::Count)});
+
+    auto sptr = static_cast<const uint8_t *>(states.request().ptr);
+    auto aptr = static_cast<int8_t *>(actions.request().ptr);
+    auto pptr = static_cast<float *>(probability.request().ptr);
+    auto tptr = static_cast<int32_t *>(stats.request().ptr);
+    auto pool = getAnalysisPool(threads);
+    {
+        py::gil_scoped_release release;
+        agent::analyzeBatch(sptr, count, geometry, *pool, aptr, pptr, tptr);
+    }
+    return py::make_tuple(actions, probability, stats);
 }
 
-bool PyTreeManager::play(int index) {
-    while (true) {
-        auto actions = agents_[index].getActions(boards_[index].getState());
-        if (actions.empty()) {
-            return false;
+py::tuple analyzeBatch(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> states, int mines,
+                       int threads) {
+    if (states.ndim() != 3) {
+        throw std::invalid_argument("states must be a count x height x width array");
+    }
+    int height = static_cast<int>(states.shape(1));
+    int width = static_cast<int>(states.shape(2));
+
+    auto isGeometry = [height, width](auto geometry) {
+        return height == geometry.height() && width == geometry.width();
+    };
+    if (mines < 0) {
+        if (isGeometry(Beginner())) {
+            mines = Beginner::mines();
+        } else if (isGeometry(Intermediate())) {
+            mines = Intermediate::mines();
+        } else if (isGeometry(Expert())) {
+            mines = Expert::mines();
+        } else {
+            throw std::invalid_argument("boards of this size need their number of mines");
         }
+    }
 
-        for (auto action: actions) {
-            auto result = boards_[index].act(action);
-            if (isTerminal(result)) {
-                log_.emplace_back(std::move(boards_[index].getLogs()));
-                return true;
-            }
-        }
+    if (isGeometry(Beginner()) && mines == Beginner::mines()) {
+        return analyzeGeometryBatch(std::move(states), Beginner(), threads);
+    }
+    if (isGeometry(Intermediate()) && mines == Intermediate::mines()) {
+        return analyzeGeometryBatch(std::move(states), Intermediate(), threads);
     }
+    if (isGeometry(Expert()) && mines == Expert::mines()) {
+        return analyzeGeometryBatch(std::move(states), Expert(), threads);
+    }
+    return analyzeGeometryBatch(std::move(states), Custom(height, width, mines), threads);
+}
+
+template class PyTreeAgent<Beginner>;
+template class PyTreeAgent<Intermediate>;
+template class PyTreeAgent<Expert>;
+template class PyTreeAgent<Custom>;
+
+template class PyTreeManager<Beginner>;
+template class PyTreeManager<Intermediate>;
+template class PyTreeManager<Expert>;
+template class PyTreeManager<Custom>;
+
+template<class G>
+py::class_<PyTreeAgent<G>> defineTreeAgent(py::module &m, const char *name) {
+    return py::class_<PyTreeAgent<G>>(m, name)
+            .def("load_state", &PyTreeAgent<G>::loadState)
+            .def("get_actions", &PyTreeAgent<G>::getActions)
+            .def("explore", &PyTreeAgent<G>::explore)
+            .def("update", &PyTreeAgent<G>::update);
+}
+
+template<class G>
+py::class_<PyTreeManager<G>> defineTreeManager(py::module &m, const char *name) {
+    return py::class_<PyTreeManager<G>>(m, name)
+            .def("get_batch", &PyTreeManager<G>::getBatch)
+            .def("get_masks", &PyTreeManager<G>::getMasks)
+            .def("get_policy", &PyTreeManager<G>::getPolicy)
+            .def("get_values", &PyTreeManager<G>::getValues)
+            .def("load_batch", &PyTreeManager<G>::loadBatch)
+            .def("load_batch", &PyTreeManager<G>::loadBuffers)
+            .def("set_log", &PyTreeManager<G>::setLog, py::arg("prefix"), py::arg("games_per_shard") = 1 << 12)
+            .def("get_finished_games", &PyTreeManager<G>::getFinishedGames);
 }
 
 PYBIND11_MODULE(engine, m) {
-    py::class_<PyTreeAgent>(m, "TreeAgent")
-            .def(py::init<>())
-            .def("load_state", &PyTreeAgent::loadState)
-            .def("get_actions", &PyTreeAgent::getActions)
-            .def("explore", &PyTreeAgent::explore)
-            .def("update", &PyTreeAgent::update);
-
-    py::class_<PyTreeManager>(m, "TreeManager")
-            .def(py::init<>([](int batchSize, int treeIter) {
-                return PyTreeManager(batchSize, treeIter);
-            }))
-            .def("get_batch", &PyTreeManager::getBatch)
-            .def("load_batch", &PyTreeManager::loadBatch);
+    defineTreeAgent<Beginner>(m, "BeginnerTreeAgent")
+            .def(py::init<>());
+    defineTreeAgent<Intermediate>(m, "IntermediateTreeAgent")
+            .def(py::init<>());
+    defineTreeAgent<Expert>(m, "ExpertTreeAgent")
+            .def(py::init<>());
+    defineTreeAgent<Custom>(m, "CustomTreeAgent")
+            .def(py::init([](int height, int width, int mines) {
+                return new PyTreeAgent<Custom>(Custom(height, width, mines));
+            }), py::arg("height"), py::arg("width"), py::arg("mines"));
+
+    defineTreeManager<Beginner>(m, "BeginnerTreeManager")
+            .def(py::init<int, int, int>(), py::arg("batch_size"), py::arg("tree_iter"), py::arg("threads") = 0);
+    defineTreeManager<Intermediate>(m, "IntermediateTreeManager")
+            .def(py::init<int, int, int>(), py::arg("batch_size"), py::arg("tree_iter"), py::arg("threads") = 0);
+    defineTreeManager<Expert>(m, "ExpertTreeManager")
+            .def(py::init<int, int, int>(), py::arg("batch_size"), py::arg("tree_iter"), py::arg("threads") = 0);
+    defineTreeManager<Custom>(m, "CustomTreeManager")
+            .def(py::init([](int batchSize, int treeIter, int height, int width, int mines, int threads) {
+                return new PyTreeManager<Custom>(batchSize, treeIter, threads, Custom(height, width, mines));
+            }), py::arg("batch_size"), py::arg("tree_iter"), py::arg("height"), py::arg("width"), py::arg("mines"),
+                 py::arg("threads") = 0);
+
+    m.def("replay_game", &replayGame, py::arg("mines"), py::arg("actions"));
+    m.def("analyze_batch", &analyzeBatch, py::arg("states"), py::arg("mines") = -1, py::arg("threads") = 0);
+
+    m.attr("TreeAgent") = m.attr("ExpertTreeAgent");
+    m.attr("TreeManager") = m.attr("ExpertTreeManager");
 }
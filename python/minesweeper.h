@@ -1,15 +1,26 @@
-#include <deque>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
 #include "agent.h"
+#include "batch.h"
+#include "selfplay.h"
 
 namespace py = pybind11;
 using namespace game;
 
+// states of a logged game, mines is its layout and actions its action ids
+py::array_t<uint8_t> replayGame(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> mines,
+                                py::array_t<uint16_t, py::array::c_style | py::array::forcecast> actions);
+
+// forced actions, mine probabilities and component statistics of count x height x width states, see
+// agent::analyzeBatch. Mines below 0 take the standard count of the board size, threads 0 one per core
+py::tuple analyzeBatch(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> states, int mines,
+                       int threads);
+
+template<class G>
 class PyTreeAgent {
 public:
-    explicit PyTreeAgent() : agent_(gen_) {}
+    explicit PyTreeAgent(G geometry = G()) : geometry_(geometry), agent_(gen_) {}
 
     void loadState(py::array_t<uint8_t, py::array::c_style | py::array::forcecast> state,
                    py::array_t<float, py::array::c_style | py::array::forcecast> policy);
@@ -21,94 +32,47 @@ public:
     void update(py::array_t<float, py::array::c_style | py::array::forcecast> policy, float value);
 
 private:
+    G geometry_;
     std::mt19937 gen_;
-    agent::TreeAgent agent_;
-};
-
-enum Task {
-    Initialize,
-    Update
-};
-
-struct Job {
-    int index;
-    Task task;
-};
-
-struct GameLog {
-    std::vector<State> states;
-    std::vector<Action> actions;
-    double result;
+    agent::TreeAgent<G> agent_;
 };
 
-class LoggingBoard {
+template<class G>
+class PyTreeManager {
 public:
-    explicit LoggingBoard(std::mt19937 &gen) : board_(gen) {}
-
-    LoggingBoard(const LoggingBoard &board) : board_(board.board_), log_(board.log_) {}
-
-    LoggingBoard &operator=(const LoggingBoard &board) {
-        *this = LoggingBoard(board);
-        return *this;
-    }
-
-    LoggingBoard(LoggingBoard &&board) : board_(std::move(board.board_)), log_(std::move(board.log_)) {}
-
-    LoggingBoard &operator=(LoggingBoard &&board) {
-        board_ = std::move(board.board_);
-        log_ = std::move(board.log_);
-        return *this;
-    }
-
-    GameResult act(Action action) {
-        log_.states.emplace_back(board_.getState());
-        log_.actions.emplace_back(action);
+    // threads is the size of the worker pool, 0 takes one per core
+    PyTreeManager(int batchSize, int treeIter, int threads = 0, G geometry = G());
 
-        auto result = board_.act(action);
-        if (isTerminal(result)) {
-            log_.result = getReward(result);
-        }
+    // Views of the buffers of the batch in flight, they stay valid until the batch is loaded and keep
+    // the manager alive. Writing the policies and values into their views spares load_batch a copy
 
-        return result;
-    }
-
-    GameLog getLogs() {
-        return std::move(log_);
-    }
+    // waits for the next batch
+    py::array_t<uint8_t> getBatch();
 
-    const State &getState() const {
-        return board_.getState();
-    }
+    // legal actions of the states of the batch
+    py::array_t<uint8_t> getMasks();
 
-private:
-    Board board_;
-    GameLog log_;
-};
-
-class PyTreeManager {
-public:
-    PyTreeManager(int batchSize, int treeIter);
+    py::array_t<float> getPolicy();
 
-    py::array_t<uint8_t> getBatch();
+    py::array_t<float> getValues();
 
     void loadBatch(py::array_t<float, py::array::c_style | py::array::forcecast> policy,
                    py::array_t<float, py::array::c_style | py::array::forcecast> values);
 
-private:
-    void initializeAgent(int index);
+    // loads what was written into the views of get_policy and get_values
+    void loadBuffers();
 
-    bool play(int index);
+    // finished games go to shards of prefix, read them with gamelog.py
+    void setLog(const std::string &prefix, int gamesPerShard);
 
-private:
-    std::mt19937 gen_;
-    std::vector<agent::TreeAgent> agents_;
-    std::vector<LoggingBoard> boards_;
+    int getFinishedGames();
 
-    std::deque<GameLog> log_;
-    std::deque<State> states_;
-    std::deque<Job> jobs_;
-    std::deque<int> free_;
+private:
+    template<class T>
+    py::array_t<T> makeView(T *ptr, std::vector<py::ssize_t> shape);
 
-    int batchSize_;
-    int treeIter_;
-};
\ No newline at end of file
+private:
+    G geometry_;
+    agent::SelfPlay<G> selfPlay_;
+    int half_ = 0;
+};
@@ -1,6 +1,6 @@
 #include "minesweeper.h"
 
 int main() {
-    PyTreeManager manager(8, 10);
+    PyTreeManager<Expert> manager(8, 10);
     return 0;
 }
\ No newline at end of file